@@ -1,9 +1,46 @@
+#include <algorithm>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <cmath>
 #include <mpi.h>
 #include <omp.h>
+#include <aio.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "gemv_kernels.h"
+
+// Checks that a dense matrix file of `file_size` bytes holds exactly the total_rows x num_cols values its
+// header announces, so that a truncated file is rejected before it is read. Process 0 reports a mismatch.
+bool check_dense_matrix_file_size(const char * filename, size_t file_size, size_t total_rows, size_t num_cols)
+{
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    // Bound the number of rows by the file size before the expected size is computed
+    size_t max_entries = file_size / sizeof(double);
+    bool success = num_cols == 0 || total_rows <= max_entries / num_cols;
+    success = success && file_size == 2 * sizeof(size_t) + total_rows * num_cols * sizeof(double);
+
+    if(!success && rank == 0)
+        fprintf(stderr, "%s holds %zu bytes, which is not the size of the %zu x %zu dense matrix in its header (a sparse matrix file needs --storage=csr or --storage=sell)\n", filename, file_size, total_rows, num_cols);
+
+    return success;
+}
+
+// check_dense_matrix_file_size for a file opened with fopen
+bool check_dense_matrix_file_size(const char * filename, FILE * file, size_t total_rows, size_t num_cols)
+{
+    struct stat file_stat;
+    return fstat(fileno(file), &file_stat) == 0 && check_dense_matrix_file_size(filename, file_stat.st_size, total_rows, num_cols);
+}
 
 bool read_matrix_from_file(const char * filename, double ** matrix_out, size_t * num_rows_out, size_t * num_cols_out)
 {   
@@ -13,215 +50,4908 @@ bool read_matrix_from_file(const char * filename, double ** matrix_out, size_t *
     double * matrix;
     size_t total_rows, num_rows_local, num_cols_local;
     FILE * file = fopen(filename, "rb");
+    if(file == nullptr)
+        return false;
+
+    // Read the total number of rows and columns from the file
+    if(fread(&total_rows, sizeof(size_t), 1, file) != 1 || fread(&num_cols_local, sizeof(size_t), 1, file) != 1
+       || !check_dense_matrix_file_size(filename, file, total_rows, num_cols_local))
+    {
+        fclose(file);
+        return false;
+    }
+    fseek(file, (rank * (total_rows / mpi_size) * num_cols_local) * sizeof(double), SEEK_CUR);
+
+    // Calculate the number of rows this process handles
+    num_rows_local = total_rows / mpi_size;
+    if(rank == mpi_size - 1) { num_rows_local += total_rows % mpi_size; }
+    
+    matrix = new double[num_rows_local * num_cols_local];
+    
+    #pragma omp parallel for schedule(static)
+    for(size_t r = 0; r < num_rows_local; r++)
+    {
+        for(size_t c = 0; c < num_cols_local; c++)
+        {
+            matrix[r * num_cols_local + c] = 0.0;
+        }
+    }
+    
+    // Read the appropriate number of doubles from the file based on the process rank
+    fread(matrix, sizeof(double), num_rows_local * num_cols_local, file);
+
+    *num_cols_out = num_cols_local;
+    *num_rows_out = num_rows_local;
+    *matrix_out = matrix;
+
+    fclose(file);
+
+    return true;
+}
+// Ways of reading the local rows of a matrix file in the 1d distribution
+enum matrix_loader
+{
+    LOADER_FREAD, // read_matrix_from_file, a zero-filled slab and one fread
+    LOADER_MMAP, // Threads copy their own rows out of a memory map, faulting the pages in in parallel
+    LOADER_MMAP_WILLNEED, // LOADER_MMAP after madvise(MADV_WILLNEED) started the read-ahead of the whole slab
+    LOADER_MMAP_POPULATE, // LOADER_MMAP with the whole slab read by the mmap call itself (MAP_POPULATE)
+    LOADER_MPIIO // Collective MPI-IO read of the slabs of all processes
+};
+
+// Reads the same rows as read_matrix_from_file through a memory map of the slab of the process. The rows
+// are copied with the static schedule of gemvP, so every thread faults in the file pages of its own rows
+// and its first touch of the destination places the pages next to the thread that later multiplies them.
+bool read_matrix_from_file_mmap(const char * filename, matrix_loader loader, double ** matrix_out, size_t * num_rows_out, size_t * num_cols_out)
+{
+    int rank, mpi_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    size_t header[2]; // Total number of rows and columns
+    struct stat file_stat;
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+        return false;
+    // Copying from a map beyond the end of the file raises SIGBUS, so the size is checked first
+    if(pread(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) || fstat(fd, &file_stat) != 0
+       || !check_dense_matrix_file_size(filename, file_stat.st_size, header[0], header[1]))
+    {
+        close(fd);
+        return false;
+    }
+
+    size_t total_rows = header[0], num_cols = header[1];
+    size_t num_rows = total_rows / mpi_size;
+    size_t row_begin = rank * num_rows;
+    if(rank == mpi_size - 1) { num_rows += total_rows % mpi_size; }
+
+    // The map has to start at a page boundary
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t data_begin = sizeof(header) + row_begin * num_cols * sizeof(double);
+    size_t data_size = num_rows * num_cols * sizeof(double);
+    size_t map_begin = data_begin / page_size * page_size;
+    size_t map_size = data_begin + data_size - map_begin;
+
+    double * matrix = new double[num_rows * num_cols];
+    bool success = true;
+    if(data_size > 0)
+    {
+        int flags = MAP_PRIVATE | ((loader == LOADER_MMAP_POPULATE) ? MAP_POPULATE : 0);
+        void * map = mmap(nullptr, map_size, PROT_READ, flags, fd, map_begin);
+        success = map != MAP_FAILED;
+        if(success)
+        {
+            if(loader == LOADER_MMAP_WILLNEED)
+                madvise(map, map_size, MADV_WILLNEED);
+
+            const double * data = (const double *)((const char *)map + (data_begin - map_begin));
+            #pragma omp parallel for schedule(static)
+            for(size_t r = 0; r < num_rows; r++)
+            {
+                memcpy(matrix + r * num_cols, data + r * num_cols, num_cols * sizeof(double));
+            }
+            munmap(map, map_size);
+        }
+    }
+    close(fd);
+
+    *matrix_out = matrix;
+    *num_rows_out = num_rows;
+    *num_cols_out = num_cols;
+
+    return success;
+}
+
+// Reads the same rows as read_matrix_from_file with one collective MPI-IO read. The file view of every
+// process starts at its slab, and collective buffering lets a few aggregator processes issue large
+// contiguous requests to the file system for all of them. Must be called by all processes.
+bool read_matrix_from_file_mpiio(const char * filename, double ** matrix_out, size_t * num_rows_out, size_t * num_cols_out)
+{
+    int rank, mpi_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    MPI_Info info;
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "romio_cb_read", "enable");
+    MPI_Info_set(info, "cb_buffer_size", "16777216");
+
+    MPI_File file;
+    int error = MPI_File_open(MPI_COMM_WORLD, filename, MPI_MODE_RDONLY, info, &file);
+    if(error != MPI_SUCCESS)
+    {
+        MPI_Info_free(&info);
+        return false;
+    }
+
+    size_t header[2]; // Total number of rows and columns
+    MPI_Status status;
+    MPI_Offset file_size;
+    int count;
+    error = MPI_File_read_at_all(file, 0, header, sizeof(header), MPI_BYTE, &status);
+    MPI_Get_count(&status, MPI_BYTE, &count);
+    MPI_File_get_size(file, &file_size);
+    // The header and the size are the same on all processes, so they all return here or none does
+    if(error != MPI_SUCCESS || count != (int)sizeof(header) || !check_dense_matrix_file_size(filename, file_size, header[0], header[1]))
+    {
+        MPI_File_close(&file);
+        MPI_Info_free(&info);
+        return false;
+    }
+
+    size_t total_rows = header[0], num_cols = header[1];
+    size_t num_rows = total_rows / mpi_size;
+    size_t row_begin = rank * num_rows;
+    if(rank == mpi_size - 1) { num_rows += total_rows % mpi_size; }
+
+    // One row is the unit of the read, so the count fits an int for any matrix that fits in memory
+    MPI_Datatype row_type;
+    MPI_Type_contiguous(num_cols, MPI_DOUBLE, &row_type);
+    MPI_Type_commit(&row_type);
+
+    double * matrix = new double[num_rows * num_cols];
+    MPI_Offset displacement = sizeof(header) + row_begin * num_cols * sizeof(double);
+    MPI_File_set_view(file, displacement, MPI_DOUBLE, MPI_DOUBLE, "native", info);
+    error = MPI_File_read_at_all(file, 0, matrix, num_rows, row_type, &status);
+    // A short read is not an error for MPI-IO, only the count of the rows read tells
+    MPI_Get_count(&status, row_type, &count);
+
+    MPI_Type_free(&row_type);
+    MPI_File_close(&file);
+    MPI_Info_free(&info);
+
+    *matrix_out = matrix;
+    *num_rows_out = num_rows;
+    *num_cols_out = num_cols;
+
+    return error == MPI_SUCCESS && (size_t)count == num_rows;
+}
+
+// Reads the local rows of the matrix file with the given loader
+bool load_matrix_from_file(const char * filename, matrix_loader loader, double ** matrix_out, size_t * num_rows_out, size_t * num_cols_out)
+{
+    if(loader == LOADER_FREAD)
+        return read_matrix_from_file(filename, matrix_out, num_rows_out, num_cols_out);
+    if(loader == LOADER_MPIIO)
+        return read_matrix_from_file_mpiio(filename, matrix_out, num_rows_out, num_cols_out);
+    return read_matrix_from_file_mmap(filename, loader, matrix_out, num_rows_out, num_cols_out);
+}
+
+
+void print_matrix(const double * matrix, size_t num_rows, size_t num_cols, FILE * file = stdout)
+{
+    fprintf(file, "%zu %zu\n", num_rows, num_cols);
+    for(size_t r = 0; r < num_rows; r++)
+    {
+        for(size_t c = 0; c < num_cols; c++)
+        {
+            double val = matrix[r * num_cols + c];
+            printf("%+6.3f ", val);
+        }
+        printf("\n");
+    }
+}
+
+// MPI datatype matching the type T
+template<typename T> MPI_Datatype mpi_datatype();
+template<> MPI_Datatype mpi_datatype<double>() { return MPI_DOUBLE; }
+template<> MPI_Datatype mpi_datatype<float>() { return MPI_FLOAT; }
+template<> MPI_Datatype mpi_datatype<unsigned long>() { return MPI_UNSIGNED_LONG; }
+
+template<typename T>
+T dotP(const T * x, const T * y, size_t size) {
+    // Initialize the result and the variable to hold the sub-products
+    T result = 0.0;
+    T sub_prod = 0.0;
+
+    // Parallelize the computation of the dot product
+    #pragma omp parallel for shared(x, y) schedule(static) reduction(+:sub_prod) 
+    for(size_t i = 0; i < size; i++) {
+        // Accumulate the product of corresponding elements
+        sub_prod += x[i] * y[i];
+    }
+    
+    // Use MPI to reduce (sum up) all the partial dot products into 'result'
+    MPI_Allreduce(&sub_prod, &result, 1, mpi_datatype<T>(), MPI_SUM, MPI_COMM_WORLD);
+
+    return result;
+}
+
+
+template<typename T>
+void axpbyP(T alpha, const T * x, T beta, T * y, size_t size)
+{
+    #pragma omp parallel for shared(x, y) schedule(static) 
+    for(size_t i = 0; i < size; i++)
+    {
+        // Perform the operation y = alpha * x + beta * y for each element
+        y[i] = alpha * x[i] + beta * y[i];
+    }
+}
+
+template<typename T>
+void gemvP(T alpha, const T * A, const T * x, T beta, T * y, size_t num_rows, size_t num_cols)
+{
+    // Parallelize over the rows of the matrix
+    #pragma omp parallel for schedule(static)
+    for(size_t r = 0; r < num_rows; r++)
+    {
+        // Initialize the accumulator for this row
+        T y_val = 0.0;
+        #pragma omp simd reduction(+:y_val)
+        for(size_t c = 0; c < num_cols; c++)
+        {
+            // Compute the dot product of the row of A and vector x, scaled by alpha
+            y_val += alpha * A[r * num_cols + c] * x[c];
+        }
+
+        // Update y by adding the scaled result to the scaled original y values,
+        // as in BLAS y is not read when beta is zero so it may be uninitialized
+        y[r] = (beta == (T)0.0) ? y_val : beta * y[r] + y_val;
+    }
+}
+
+// Kernel of gemvP for double precision, the best one for the processor unless main chose another
+gemv_kernel gemv_rows = select_gemv_kernel(detect_gemv_isa());
+
+// Double precision matrix-vector products use the register-blocked SIMD kernels. Every thread runs the
+// kernel on the rows it gets from schedule(static), so the rows stay with the same threads as elsewhere.
+template<>
+void gemvP<double>(double alpha, const double * A, const double * x, double beta, double * y, size_t num_rows, size_t num_cols)
+{
+    #pragma omp parallel
+    {
+        size_t row_begin, row_end;
+        static_thread_rows(num_rows, omp_get_thread_num(), omp_get_num_threads(), &row_begin, &row_end);
+        gemv_rows(alpha, A + row_begin * num_cols, x, beta, y + row_begin, row_end - row_begin, num_cols, num_cols);
+    }
+}
+
+// Ap = A*p for the local rows and the dot product of p_local and Ap reduced over all processes, in one
+// pass over the rows. Every entry of Ap enters the dot product right after it is computed, instead of in
+// a second parallel loop that reads both vectors again.
+template<typename T>
+T gemv_dotP(const T * A, const T * p, const T * p_local, T * Ap, size_t num_rows, size_t num_cols)
+{
+    T result = 0.0;
+    T sub_prod = 0.0;
+
+    #pragma omp parallel for schedule(static) reduction(+:sub_prod)
+    for(size_t r = 0; r < num_rows; r++)
+    {
+        T y_val = 0.0;
+        #pragma omp simd reduction(+:y_val)
+        for(size_t c = 0; c < num_cols; c++)
+        {
+            y_val += A[r * num_cols + c] * p[c];
+        }
+        Ap[r] = y_val;
+        sub_prod += p_local[r] * y_val;
+    }
+
+    MPI_Allreduce(&sub_prod, &result, 1, mpi_datatype<T>(), MPI_SUM, MPI_COMM_WORLD);
+
+    return result;
+}
+
+// Double precision uses the gemvP kernel, every thread accumulates the dot product over its rows of Ap
+// while they are still in its cache
+template<>
+double gemv_dotP<double>(const double * A, const double * p, const double * p_local, double * Ap, size_t num_rows, size_t num_cols)
+{
+    double result = 0.0;
+    double sub_prod = 0.0;
+
+    #pragma omp parallel reduction(+:sub_prod)
+    {
+        size_t row_begin, row_end;
+        static_thread_rows(num_rows, omp_get_thread_num(), omp_get_num_threads(), &row_begin, &row_end);
+        gemv_rows(1.0, A + row_begin * num_cols, p, 0.0, Ap + row_begin, row_end - row_begin, num_cols, num_cols);
+        for(size_t r = row_begin; r < row_end; r++)
+        {
+            sub_prod += p_local[r] * Ap[r];
+        }
+    }
+
+    MPI_Allreduce(&sub_prod, &result, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+    return result;
+}
+
+// The CG update x = x + alpha*p and r = r - alpha*Ap in one sweep, returns r*r of the updated residual
+// reduced over all processes
+template<typename T>
+T fused_updateP(T alpha, const T * p, const T * Ap, T * x, T * r, size_t size)
+{
+    T result = 0.0;
+    T sub_prod = 0.0;
+
+    #pragma omp parallel for simd schedule(static) reduction(+:sub_prod)
+    for(size_t i = 0; i < size; i++)
+    {
+        x[i] += alpha * p[i];
+        T r_val = r[i] - alpha * Ap[i];
+        r[i] = r_val;
+        sub_prod += r_val * r_val;
+    }
+
+    MPI_Allreduce(&sub_prod, &result, 1, mpi_datatype<T>(), MPI_SUM, MPI_COMM_WORLD);
+
+    return result;
+}
+
+// Y = A*X for `num_vecs` vectors at once, so the matrix is streamed only once for all of them.
+// X is row-major with `num_cols` rows, Y is row-major with `num_rows` rows, both with `num_vecs` columns.
+void gemmP(const double * A, const double * X, double * Y, size_t num_rows, size_t num_cols, size_t num_vecs)
+{
+    // A single vector is better served by the row dot products of gemvP
+    if(num_vecs == 1)
+    {
+        gemvP(1.0, A, X, 0.0, Y, num_rows, num_cols);
+        return;
+    }
+
+    #pragma omp parallel for schedule(static)
+    for(size_t r = 0; r < num_rows; r++)
+    {
+        double * y_row = Y + r * num_vecs;
+        for(size_t k = 0; k < num_vecs; k++)
+        {
+            y_row[k] = 0.0;
+        }
+        for(size_t c = 0; c < num_cols; c++)
+        {
+            // Every loaded matrix element is used for all the vectors
+            double a = A[r * num_cols + c];
+            const double * x_row = X + c * num_vecs;
+            #pragma omp simd
+            for(size_t k = 0; k < num_vecs; k++)
+            {
+                y_row[k] += a * x_row[k];
+            }
+        }
+    }
+}
+
+// Number of eigenvalues of the symmetric tridiagonal matrix (see below) smaller than `shift`,
+// the number of negative pivots in the LDL^T factorization of the shifted matrix
+size_t tridiagonal_count_below(const double * diag, const double * offdiag, size_t n, double shift)
+{
+    size_t count = 0;
+    double d = 1.0;
+    for(size_t i = 0; i < n; i++)
+    {
+        double off2 = (i > 0) ? offdiag[i-1] * offdiag[i-1] : 0.0;
+        d = diag[i] - shift - off2 / d;
+        if(d == 0.0) d = -1e-300;
+        if(d < 0.0) count++;
+    }
+    return count;
+}
+
+// Smallest and largest eigenvalue of the symmetric tridiagonal matrix with diagonal `diag` and
+// off-diagonal `offdiag` (n-1 entries), found by bisection on Sturm sequence counts.
+void tridiagonal_extreme_eigenvalues(const double * diag, const double * offdiag, size_t n, double * eig_min, double * eig_max)
+{
+    // Gershgorin bounds enclose the whole spectrum
+    double lower = diag[0], upper = diag[0];
+    for(size_t i = 0; i < n; i++)
+    {
+        double radius = (i > 0 ? std::abs(offdiag[i-1]) : 0.0) + (i + 1 < n ? std::abs(offdiag[i]) : 0.0);
+        lower = std::fmin(lower, diag[i] - radius);
+        upper = std::fmax(upper, diag[i] + radius);
+    }
+
+    // The k-th smallest eigenvalue is where the count of eigenvalues below the midpoint exceeds k
+    double bounds[2];
+    size_t targets[2] = {0, n - 1};
+    for(int e = 0; e < 2; e++)
+    {
+        double lo = lower, hi = upper;
+        for(int it = 0; it < 100 && hi - lo > 1e-12 * (std::abs(lo) + std::abs(hi)); it++)
+        {
+            double mid = 0.5 * (lo + hi);
+            if(tridiagonal_count_below(diag, offdiag, n, mid) > targets[e]) hi = mid;
+            else lo = mid;
+        }
+        bounds[e] = 0.5 * (lo + hi);
+    }
+
+    *eig_min = bounds[0];
+    *eig_max = bounds[1];
+}
+
+// Fill the number of rows owned by each process and their starting offsets, the last process takes the remainder
+void compute_row_distribution(size_t total_rows, int mpi_size, int * rows_per_processes, int * row_offsets)
+{
+    for(int i = 0; i < mpi_size; i++)
+    {
+        rows_per_processes[i] = total_rows / mpi_size;
+    }
+    rows_per_processes[mpi_size - 1] += total_rows % mpi_size;
+
+    row_offsets[0] = 0;
+    for(int i = 1; i < mpi_size; i++)
+    {
+        row_offsets[i] = row_offsets[i-1] + rows_per_processes[i-1];
+    }
+}
+
+// Every process writes its `local_size` rows of the solution with `num_cols` columns at row `row_offset` of the output file
+void write_solution_to_file(const char * filename, const double * x, size_t local_size, size_t row_offset, size_t num_cols = 1)
+{
+    MPI_File file;
+    MPI_Status status;
+
+    MPI_File_open(MPI_COMM_WORLD, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file);
+    MPI_File_seek(file, row_offset * num_cols * sizeof(double), MPI_SEEK_SET);
+    MPI_File_write(file, x, local_size * num_cols, MPI_DOUBLE, &status);
+    MPI_File_close(&file);
+}
+
+// Every process reads its `local_size` entries of a vector at row `row_offset` of a file written by write_solution_to_file.
+// Returns false if the file cannot be read or does not hold exactly `total_rows` values.
+bool read_vector_from_file(const char * filename, double * x, size_t local_size, size_t row_offset, size_t total_rows)
+{
+    MPI_File file;
+    MPI_Offset file_size;
+
+    if(MPI_File_open(MPI_COMM_WORLD, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS)
+        return false;
+    MPI_File_get_size(file, &file_size);
+    bool success = (size_t)file_size == total_rows * sizeof(double);
+    if(success)
+        success = MPI_File_read_at_all(file, row_offset * sizeof(double), x, local_size, MPI_DOUBLE, MPI_STATUS_IGNORE) == MPI_SUCCESS;
+    MPI_File_close(&file);
+    return success;
+}
+
+// Reads block (grid_row, grid_col) of the matrix split into grid_rows x grid_cols blocks, the last block
+// row and column take the remainder. The block is stored row-major, its size and position and the size
+// of the whole matrix are returned.
+bool read_matrix_block_from_file(const char * filename, int grid_rows, int grid_cols, int grid_row, int grid_col, double ** matrix_out, size_t * block_rows_out, size_t * block_cols_out, size_t * row_begin_out, size_t * col_begin_out, size_t * total_rows_out, size_t * total_cols_out)
+{
+    size_t total_rows, total_cols;
+    FILE * file = fopen(filename, "rb");
+    if(file == nullptr)
+        return false;
+
+    if(fread(&total_rows, sizeof(size_t), 1, file) != 1 || fread(&total_cols, sizeof(size_t), 1, file) != 1
+       || !check_dense_matrix_file_size(filename, file, total_rows, total_cols))
+    {
+        fclose(file);
+        return false;
+    }
+
+    int * block_row_sizes = new int[grid_rows];
+    int * block_row_offsets = new int[grid_rows];
+    int * block_col_sizes = new int[grid_cols];
+    int * block_col_offsets = new int[grid_cols];
+    compute_row_distribution(total_rows, grid_rows, block_row_sizes, block_row_offsets);
+    compute_row_distribution(total_cols, grid_cols, block_col_sizes, block_col_offsets);
+    size_t block_rows = block_row_sizes[grid_row];
+    size_t block_cols = block_col_sizes[grid_col];
+    size_t row_begin = block_row_offsets[grid_row];
+    size_t col_begin = block_col_offsets[grid_col];
+
+    // Every row of the block is a contiguous piece of a matrix row in the file
+    double * matrix = new double[block_rows * block_cols];
+    bool success = true;
+    for(size_t r = 0; r < block_rows && success; r++)
+    {
+        long offset = 2 * sizeof(size_t) + ((row_begin + r) * total_cols + col_begin) * sizeof(double);
+        success = fseek(file, offset, SEEK_SET) == 0 && fread(matrix + r * block_cols, sizeof(double), block_cols, file) == block_cols;
+    }
+
+    fclose(file);
+    delete[] block_row_sizes;
+    delete[] block_row_offsets;
+    delete[] block_col_sizes;
+    delete[] block_col_offsets;
+
+    *matrix_out = matrix;
+    *block_rows_out = block_rows;
+    *block_cols_out = block_cols;
+    *row_begin_out = row_begin;
+    *col_begin_out = col_begin;
+    *total_rows_out = total_rows;
+    *total_cols_out = total_cols;
+
+    return success;
+}
+
+// Checkpointing of conjugate_gradients
+struct checkpoint_settings
+{
+    const char * filename; // Checkpoints alternate between filename.0 and filename.1, nullptr for none
+    size_t interval; // Iterations between checkpoints
+    const char * restart_filename; // Base name of the checkpoints to resume from, nullptr to start from x = 0
+};
+
+// Header of a checkpoint file, followed by the global vectors x, r and p
+struct checkpoint_header
+{
+    size_t magic; // CHECKPOINT_MAGIC once the vectors are complete, 0 while they are written
+    size_t total_rows;
+    size_t value_size; // sizeof(T) of the vectors
+    size_t num_iters; // Iterations done
+    size_t mpi_size; // A restart is bit-for-bit identical only with the same numbers of processes and threads
+    double rr, bb;
+};
+
+const size_t CHECKPOINT_MAGIC = 0x5043474350; // "PCGCP"
+
+// Checkpoints written in the background. The local parts of x, r and p are copied into a buffer and
+// written with non-blocking collective writes that complete while the following iterations run; the
+// checkpoint becomes valid when its header is written after the writes completed. The two files are
+// used in turn, so a process killed during a write always leaves the previous checkpoint intact.
+template<typename T>
+struct checkpoint_writer
+{
+    MPI_File files[2];
+    MPI_Request requests[3]; // Writes of x, r and p in flight
+    T * buffer; // Copies of x, r and p that are being written
+    size_t local_size, total_rows, row_offset;
+    int pending; // File of the checkpoint in flight, -1 if none
+    size_t num_started;
+    checkpoint_header header; // Header of the checkpoint in flight
+    double stall_time; // Time the iterations spent starting and finishing checkpoints
+};
+
+// Name of checkpoint file `slot` with base name `filename`, to be deleted by the caller
+char * checkpoint_file_name(const char * filename, int slot)
+{
+    size_t length = strlen(filename) + 3;
+    char * name = new char[length];
+    snprintf(name, length, "%s.%d", filename, slot);
+    return name;
+}
+
+template<typename T>
+bool open_checkpoint_writer(const char * filename, size_t local_size, size_t total_rows, size_t row_offset, checkpoint_writer<T> * W)
+{
+    for(int slot = 0; slot < 2; slot++)
+    {
+        char * name = checkpoint_file_name(filename, slot);
+        bool success = MPI_File_open(MPI_COMM_WORLD, name, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &W->files[slot]) == MPI_SUCCESS;
+        delete[] name;
+        if(!success)
+        {
+            if(slot == 1)
+                MPI_File_close(&W->files[0]);
+            return false;
+        }
+    }
+    W->buffer = new T[3 * local_size];
+    W->local_size = local_size;
+    W->total_rows = total_rows;
+    W->row_offset = row_offset;
+    W->pending = -1;
+    W->num_started = 0;
+    W->stall_time = 0.0;
+    return true;
+}
+
+// Waits for the checkpoint in flight and marks it valid
+template<typename T>
+void finish_checkpoint(checkpoint_writer<T> * W)
+{
+    if(W->pending < 0)
+        return;
+
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    MPI_File file = W->files[W->pending];
+    MPI_Waitall(3, W->requests, MPI_STATUSES_IGNORE);
+    MPI_File_sync(file);
+    if(rank == 0)
+        MPI_File_write_at(file, 0, &W->header, sizeof(checkpoint_header), MPI_BYTE, MPI_STATUS_IGNORE);
+    W->pending = -1;
+}
+
+// Starts writing the state after `num_iters` iterations, the previous checkpoint is finished first
+template<typename T>
+void start_checkpoint(checkpoint_writer<T> * W, const T * x, const T * r, const T * p_local, size_t num_iters, T rr, T bb)
+{
+    int rank, mpi_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    double start_time = MPI_Wtime();
+    finish_checkpoint(W);
+
+    // Invalidate the older checkpoint in this file before overwriting its vectors
+    int slot = W->num_started++ % 2;
+    MPI_File file = W->files[slot];
+    checkpoint_header header = {0, W->total_rows, sizeof(T), num_iters, (size_t)mpi_size, (double)rr, (double)bb};
+    if(rank == 0)
+        MPI_File_write_at(file, 0, &header, sizeof(checkpoint_header), MPI_BYTE, MPI_STATUS_IGNORE);
+    header.magic = CHECKPOINT_MAGIC;
+    W->header = header;
+
+    size_t local_size = W->local_size;
+    const T * vectors[3] = {x, r, p_local};
+    for(int v = 0; v < 3; v++)
+    {
+        T * copy = W->buffer + v * local_size;
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            copy[i] = vectors[v][i];
+        }
+        MPI_Offset offset = sizeof(checkpoint_header) + (v * W->total_rows + W->row_offset) * sizeof(T);
+        MPI_File_iwrite_at_all(file, offset, copy, local_size, mpi_datatype<T>(), &W->requests[v]);
+    }
+    W->pending = slot;
+    W->stall_time += MPI_Wtime() - start_time;
+}
+
+template<typename T>
+void close_checkpoint_writer(checkpoint_writer<T> * W)
+{
+    double start_time = MPI_Wtime();
+    finish_checkpoint(W);
+    W->stall_time += MPI_Wtime() - start_time;
+    MPI_File_close(&W->files[0]);
+    MPI_File_close(&W->files[1]);
+    delete[] W->buffer;
+}
+
+// Reads the newest valid checkpoint with base name `filename` into the local parts of x, r and p.
+// Returns false if neither file holds a valid checkpoint of a system of this size and type.
+template<typename T>
+bool read_checkpoint(const char * filename, T * x, T * r, T * p_local, size_t local_size, size_t total_rows, size_t row_offset, size_t * num_iters_out, T * rr_out, T * bb_out)
+{
+    int rank, mpi_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    MPI_File files[2];
+    checkpoint_header headers[2];
+    int newest = -1;
+    for(int slot = 0; slot < 2; slot++)
+    {
+        char * name = checkpoint_file_name(filename, slot);
+        bool valid = MPI_File_open(MPI_COMM_WORLD, name, MPI_MODE_RDONLY, MPI_INFO_NULL, &files[slot]) == MPI_SUCCESS;
+        delete[] name;
+        if(!valid)
+            continue;
+
+        checkpoint_header * h = &headers[slot];
+        MPI_Status status;
+        int count = 0;
+        MPI_File_read_at_all(files[slot], 0, h, sizeof(checkpoint_header), MPI_BYTE, &status);
+        MPI_Get_count(&status, MPI_BYTE, &count);
+        valid = count == (int)sizeof(checkpoint_header) && h->magic == CHECKPOINT_MAGIC && h->total_rows == total_rows && h->value_size == sizeof(T);
+        if(!valid)
+            MPI_File_close(&files[slot]);
+        else if(newest < 0 || h->num_iters > headers[newest].num_iters)
+        {
+            if(newest >= 0)
+                MPI_File_close(&files[newest]);
+            newest = slot;
+        }
+        else
+            MPI_File_close(&files[slot]);
+    }
+    if(newest < 0)
+        return false;
+
+    T * vectors[3] = {x, r, p_local};
+    for(int v = 0; v < 3; v++)
+    {
+        MPI_Offset offset = sizeof(checkpoint_header) + (v * total_rows + row_offset) * sizeof(T);
+        MPI_File_read_at_all(files[newest], offset, vectors[v], local_size, mpi_datatype<T>(), MPI_STATUS_IGNORE);
+    }
+    MPI_File_close(&files[newest]);
+
+    checkpoint_header * h = &headers[newest];
+    if(rank == 0 && h->mpi_size != (size_t)mpi_size)
+        printf("The checkpoint was written by %zu processes, the iterations will not be bit-for-bit identical to an uninterrupted run\n", h->mpi_size);
+    *num_iters_out = h->num_iters;
+    *rr_out = (T)h->rr;
+    *bb_out = (T)h->bb;
+    return true;
+}
+
+// Sum of the partial inner products of the threads, `stride` doubles apart, added in thread order and
+// reduced over all processes
+double reduce_thread_partials(const double * partial, int num_threads, size_t stride)
+{
+    double local_sum = 0.0, global_sum;
+    for(int t = 0; t < num_threads; t++)
+    {
+        local_sum += partial[t * stride];
+    }
+    MPI_Allreduce(&local_sum, &global_sum, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    return global_sum;
+}
+
+// Conjugate gradients with one OpenMP parallel region around the whole iteration loop instead of one per
+// vector operation. Every thread owns the rows of the local slab that schedule(static) gives it and does
+// all the vector work on them, the partial inner products of the threads are combined by the master
+// thread, which also makes all the MPI calls as MPI_THREAD_FUNNELED requires, and barriers separate the
+// phases. Partial sums are added in thread order, so the results do not depend on the timing of the threads.
+// Parameters and return value are the same as for conjugate_gradients.
+bool persistent_conjugate_gradients(const double * A, const double * b, double * x, size_t local_size, size_t total_rows, size_t max_iters, double rel_error)
+{
+    int rank, mpi_size; // MPI process rank and total number of processes
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    const size_t PARTIAL_STRIDE = 8; // Doubles between the partial sums of two threads, one cache line
+    size_t num_iters = 0; // Counter for the number of iterations
+    bool done = false; // Set by the master thread when the iterations end
+    double alpha = 0.0, beta = 0.0, rr = 0.0, bb = 0.0; // Scalars for algorithm steps
+    double * p = new double[total_rows]; // Global search direction vector
+    double * p_local = new double[local_size]; // Local search direction vector
+    double * Ap_local = new double[local_size]; // Local matrix-vector product result
+    double * r = new double[local_size]; // Local residual vector
+    double * partial = new double[omp_get_max_threads() * PARTIAL_STRIDE]; // Partial inner products of the threads
+
+    int * rows_per_processes = new int[mpi_size]; // Number of rows handled by each process
+    int * row_offsets = new int[mpi_size]; // Starting offset of rows for each process
+    compute_row_distribution(total_rows, mpi_size, rows_per_processes, row_offsets);
+
+    #pragma omp parallel
+    {
+        int thread = omp_get_thread_num();
+        int num_threads = omp_get_num_threads();
+        size_t row_begin, row_end; // Rows owned by this thread
+        static_thread_rows(local_size, thread, num_threads, &row_begin, &row_end);
+
+        // Initialize x to zero and r and p to b
+        double sum = 0.0;
+        for(size_t i = row_begin; i < row_end; i++)
+        {
+            x[i] = 0.0;
+            r[i] = p_local[i] = b[i];
+            sum += b[i] * b[i];
+        }
+        partial[thread * PARTIAL_STRIDE] = sum;
+        #pragma omp barrier
+        #pragma omp master
+        {
+            bb = rr = reduce_thread_partials(partial, num_threads, PARTIAL_STRIDE);
+            MPI_Allgatherv(p_local, local_size, MPI_DOUBLE, p, rows_per_processes, row_offsets, MPI_DOUBLE, MPI_COMM_WORLD);
+        }
+        #pragma omp barrier
+
+        for(size_t iter = 1; iter <= max_iters; iter++)
+        {
+            // Ap and p*Ap for the rows of the thread
+            gemv_rows(1.0, A + row_begin * total_rows, p, 0.0, Ap_local + row_begin, row_end - row_begin, total_rows, total_rows);
+            sum = 0.0;
+            for(size_t i = row_begin; i < row_end; i++)
+            {
+                sum += p_local[i] * Ap_local[i];
+            }
+            partial[thread * PARTIAL_STRIDE] = sum;
+            #pragma omp barrier
+            #pragma omp master
+            {
+                alpha = rr / reduce_thread_partials(partial, num_threads, PARTIAL_STRIDE);
+            }
+            #pragma omp barrier
+
+            // Update x and r and compute the new residual norm
+            sum = 0.0;
+            #pragma omp simd reduction(+:sum)
+            for(size_t i = row_begin; i < row_end; i++)
+            {
+                x[i] += alpha * p_local[i];
+                r[i] -= alpha * Ap_local[i];
+                sum += r[i] * r[i];
+            }
+            partial[thread * PARTIAL_STRIDE] = sum;
+            #pragma omp barrier
+            #pragma omp master
+            {
+                double rr_new = reduce_thread_partials(partial, num_threads, PARTIAL_STRIDE);
+                beta = rr_new / rr;
+                rr = rr_new;
+                num_iters = iter;
+
+                // Check for convergence
+                done = std::sqrt(rr / bb) < rel_error;
+            }
+            #pragma omp barrier
+            if(done)
+                break;
+
+            // Update the search direction and gather the result from all processes
+            for(size_t i = row_begin; i < row_end; i++)
+            {
+                p_local[i] = r[i] + beta * p_local[i];
+            }
+            #pragma omp barrier
+            #pragma omp master
+            {
+                MPI_Allgatherv(p_local, local_size, MPI_DOUBLE, p, rows_per_processes, row_offsets, MPI_DOUBLE, MPI_COMM_WORLD);
+            }
+            #pragma omp barrier
+        }
+    }
+
+    if(rank == 0)
+    {
+        if(done)
+            printf("Converged in %zu iterations, relative error is %e\n", num_iters, std::sqrt(rr / bb));
+        else
+            printf("Did not converge in %zu iterations, relative error is %e\n", max_iters, std::sqrt(rr / bb));
+    }
+
+    delete[] p;
+    delete[] p_local;
+    delete[] Ap_local;
+    delete[] r;
+    delete[] partial;
+    delete[] rows_per_processes;
+    delete[] row_offsets;
+
+    return done;
+}
+
+// q = A*w with the gather of w and the non-blocking `reduction` in flight. The master thread of the team
+// is reserved as the communication thread: it starts the gather and calls MPI_Test on both requests until
+// they complete, which drives their progress even on MPI libraries without asynchronous progress, while
+// the other threads multiply. They start with the diagonal block, the columns of the rows of this process,
+// which needs only the local part of w, and do the other columns once the gather completed.
+// The master thread makes all the MPI calls, so MPI_THREAD_FUNNELED is enough. It spins on MPI_Test and
+// needs a core of its own, so OMP_NUM_THREADS should leave one core per process to it; it yields the core
+// after every test that found nothing to do, and the workers waiting for the gather yield too, so they
+// all still get the cores when these are oversubscribed.
+// With one thread the multiplication and the communication take turns.
+void progress_thread_gather_gemv(const double * A, const double * w_local, double * w, double * q, size_t local_size, size_t total_rows, const int * rows_per_processes, const int * row_offsets, MPI_Request * reduction)
+{
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    size_t col_begin = row_offsets[rank], col_end = col_begin + local_size; // Diagonal block columns
+    int gather_done = 0; // Set by the communication thread, read by the workers
+    MPI_Request gather;
+    MPI_Iallgatherv(w_local, local_size, MPI_DOUBLE, w, rows_per_processes, row_offsets, MPI_DOUBLE, MPI_COMM_WORLD, &gather);
+
+    #pragma omp parallel
+    {
+        int thread = omp_get_thread_num();
+        int num_threads = omp_get_num_threads();
+        bool worker = thread > 0 || num_threads == 1;
+        size_t row_begin = 0, row_end = 0; // Rows of this worker
+        if(worker)
+        {
+            static_thread_rows(local_size, std::max(thread - 1, 0), std::max(num_threads - 1, 1), &row_begin, &row_end);
+            gemv_rows(1.0, A + row_begin * total_rows + col_begin, w_local, 0.0, q + row_begin, row_end - row_begin, local_size, total_rows);
+        }
+
+        if(thread == 0)
+        {
+            int reduction_done = 0, done = 0;
+            while(!done || !reduction_done)
+            {
+                if(!done)
+                {
+                    MPI_Test(&gather, &done, MPI_STATUS_IGNORE);
+                    if(done)
+                    {
+                        #pragma omp atomic write seq_cst
+                        gather_done = 1;
+                    }
+                }
+                if(!reduction_done)
+                    MPI_Test(reduction, &reduction_done, MPI_STATUS_IGNORE);
+                if(!done || !reduction_done)
+                    sched_yield();
+            }
+        }
+
+        if(worker)
+        {
+            int ready = 0;
+            while(true)
+            {
+                #pragma omp atomic read seq_cst
+                ready = gather_done;
+                if(ready)
+                    break;
+                sched_yield();
+            }
+            size_t num_rows = row_end - row_begin;
+            gemv_rows(1.0, A + row_begin * total_rows, w, 1.0, q + row_begin, num_rows, col_begin, total_rows);
+            gemv_rows(1.0, A + row_begin * total_rows + col_end, w + col_end, 1.0, q + row_begin, num_rows, total_rows - col_end, total_rows);
+        }
+    }
+}
+
+// Pipelined conjugate gradients (Ghysels and Vanroose). Both inner products of an iteration are
+// combined into one non-blocking reduction, which stays in flight while the next search direction
+// is gathered and multiplied by `A`. With `progress_thread` the gather is non-blocking too and one thread
+// drives both while the others multiply, see progress_thread_gather_gemv.
+// The other parameters and the return value are the same as for conjugate_gradients.
+bool pipelined_conjugate_gradients(const double * A, const double * b, double * x, size_t local_size, size_t total_rows, size_t max_iters, double rel_error, bool progress_thread = false)
+{
+    int rank, mpi_size; // MPI process rank and total number of processes
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    size_t num_iters; // Counter for the number of iterations
+    bool converged = false;
+    double alpha = 0.0, alpha_old = 0.0, beta = 0.0, gamma = 0.0, gamma_old = 0.0, delta, bb; // Scalars for algorithm steps
+    double local_dots[2], global_dots[2]; // Local and reduced values of r*r and w*r
+    double * r = new double[local_size]; // Local residual vector
+    double * w_local = new double[local_size]; // Local part of A*r
+    double * w = new double[total_rows]; // Global A*r, gathered for the matrix-vector product
+    double * q = new double[local_size]; // Local part of A*w
+    double * p = new double[local_size]; // Local search direction vector
+    double * s = new double[local_size]; // Local part of A*p
+    double * z = new double[local_size]; // Local part of A*s
+    MPI_Request request;
+    double overlap_time = 0.0, wait_time = 0.0; // Time spent computing and waiting while the reduction is in flight
+
+    int * rows_per_processes = new int[mpi_size]; // Number of rows handled by each process
+    int * row_offsets = new int[mpi_size]; // Starting offset of rows for each process
+    compute_row_distribution(total_rows, mpi_size, rows_per_processes, row_offsets);
+
+    // Initialize x to zero, r to b and the recurrences of A*p and A*s to zero
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < local_size; i++)
+    {
+        x[i] = 0.0;
+        r[i] = b[i];
+        p[i] = s[i] = z[i] = 0.0;
+    }
+
+    bb = dotP(b, b, local_size);
+
+    // w = A*r needs the whole initial residual
+    MPI_Allgatherv(r, local_size, MPI_DOUBLE, w, rows_per_processes, row_offsets, MPI_DOUBLE, MPI_COMM_WORLD);
+    gemvP(1.0, A, w, 0.0, w_local, local_size, total_rows);
+
+    for(num_iters = 0; ; num_iters++)
+    {
+        // Local parts of gamma = r*r and delta = w*r, reduced together without blocking
+        double rr_local = 0.0, wr_local = 0.0;
+        #pragma omp parallel for schedule(static) reduction(+:rr_local, wr_local)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            rr_local += r[i] * r[i];
+            wr_local += w_local[i] * r[i];
+        }
+        local_dots[0] = rr_local;
+        local_dots[1] = wr_local;
+        double overlap_start = MPI_Wtime();
+        MPI_Iallreduce(local_dots, global_dots, 2, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD, &request);
+
+        // Overlap the reduction with q = A*w
+        if(progress_thread)
+            progress_thread_gather_gemv(A, w_local, w, q, local_size, total_rows, rows_per_processes, row_offsets, &request);
+        else
+        {
+            MPI_Allgatherv(w_local, local_size, MPI_DOUBLE, w, rows_per_processes, row_offsets, MPI_DOUBLE, MPI_COMM_WORLD);
+            gemvP(1.0, A, w, 0.0, q, local_size, total_rows);
+        }
+
+        double wait_start = MPI_Wtime();
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+        overlap_time += wait_start - overlap_start;
+        wait_time += MPI_Wtime() - wait_start;
+
+        gamma = global_dots[0];
+        delta = global_dots[1];
+
+        // Check for convergence, r is the residual after num_iters updates
+        if(std::sqrt(gamma / bb) < rel_error)
+        {
+            converged = true;
+            break;
+        }
+        if(num_iters == max_iters)
+            break;
+
+        if(num_iters > 0)
+        {
+            beta = gamma / gamma_old;
+            alpha = gamma / (delta - beta * gamma / alpha_old);
+        }
+        else
+        {
+            beta = 0.0;
+            alpha = gamma / delta;
+        }
+
+        // Update the recurrences for the search direction, its products with A, the solution and the residual
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            z[i] = q[i] + beta * z[i];
+            s[i] = w_local[i] + beta * s[i];
+            p[i] = r[i] + beta * p[i];
+            x[i] += alpha * p[i];
+            r[i] -= alpha * s[i];
+            w_local[i] -= alpha * z[i];
+        }
+
+        gamma_old = gamma;
+        alpha_old = alpha;
+    }
+
+    double times_local[2] = {overlap_time, wait_time};
+    double times_max[2];
+    MPI_Reduce(times_local, times_max, 2, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    if(rank == 0)
+    {
+        if(converged)
+            printf("Converged in %zu iterations, relative error is %e\n", num_iters, std::sqrt(gamma / bb));
+        else
+            printf("Did not converge in %zu iterations, relative error is %e\n", max_iters, std::sqrt(gamma / bb));
+        printf("Reductions were hidden behind %f seconds of matrix-vector work, %f seconds were spent waiting for them\n", times_max[0], times_max[1]);
+    }
+
+    delete[] r;
+    delete[] w_local;
+    delete[] w;
+    delete[] q;
+    delete[] p;
+    delete[] s;
+    delete[] z;
+    delete[] rows_per_processes;
+    delete[] row_offsets;
+
+    return converged;
+}
+
+// Conjugate gradients reformulated by Chronopoulos and Gear. Both r*r and w*r, with w = A*r, are
+// computed after the matrix-vector product and reduced together, so every iteration needs a single
+// MPI_Allreduce instead of two. Parameters and return value are the same as for conjugate_gradients.
+bool single_reduction_conjugate_gradients(const double * A, const double * b, double * x, size_t local_size, size_t total_rows, size_t max_iters, double rel_error)
+{
+    int rank, mpi_size; // MPI process rank and total number of processes
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    size_t num_iters; // Counter for the number of iterations
+    bool converged = false;
+    double alpha = 0.0, beta, gamma = 0.0, gamma_new, delta, bb = 0.0; // Scalars for algorithm steps
+    double local_dots[2], global_dots[2]; // Local and reduced values of r*r and w*r
+    double * r = new double[local_size]; // Local residual vector
+    double * r_global = new double[total_rows]; // Global residual, gathered for the matrix-vector product
+    double * w = new double[local_size]; // Local part of A*r
+    double * p = new double[local_size]; // Local search direction vector
+    double * s = new double[local_size]; // Local part of A*p
+
+    int * rows_per_processes = new int[mpi_size]; // Number of rows handled by each process
+    int * row_offsets = new int[mpi_size]; // Starting offset of rows for each process
+    compute_row_distribution(total_rows, mpi_size, rows_per_processes, row_offsets);
+
+    // Initialize x to zero, r to b and the search direction and its product with A to zero
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < local_size; i++)
+    {
+        x[i] = 0.0;
+        r[i] = b[i];
+        p[i] = s[i] = 0.0;
+    }
+
+    for(num_iters = 0; ; num_iters++)
+    {
+        // w = A*r, then r*r and w*r are reduced with one collective
+        MPI_Allgatherv(r, local_size, MPI_DOUBLE, r_global, rows_per_processes, row_offsets, MPI_DOUBLE, MPI_COMM_WORLD);
+        gemvP(1.0, A, r_global, 0.0, w, local_size, total_rows);
+
+        double rr_local = 0.0, wr_local = 0.0;
+        #pragma omp parallel for schedule(static) reduction(+:rr_local, wr_local)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            rr_local += r[i] * r[i];
+            wr_local += w[i] * r[i];
+        }
+        local_dots[0] = rr_local;
+        local_dots[1] = wr_local;
+        MPI_Allreduce(local_dots, global_dots, 2, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        gamma_new = global_dots[0];
+        delta = global_dots[1];
+
+        if(num_iters == 0)
+        {
+            bb = gamma_new;
+            beta = 0.0;
+            alpha = gamma_new / delta;
+        }
+        else
+        {
+            // Check for convergence, r is the residual after num_iters updates
+            if(std::sqrt(gamma_new / bb) < rel_error)
+            {
+                converged = true;
+                gamma = gamma_new;
+                break;
+            }
+            beta = gamma_new / gamma;
+            alpha = gamma_new / (delta - beta * gamma_new / alpha);
+        }
+        gamma = gamma_new;
+
+        if(num_iters == max_iters)
+            break;
+
+        // Update the search direction, its product with A, the solution and the residual in one sweep
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            p[i] = r[i] + beta * p[i];
+            s[i] = w[i] + beta * s[i];
+            x[i] += alpha * p[i];
+            r[i] -= alpha * s[i];
+        }
+    }
+
+    if(rank == 0)
+    {
+        if(converged)
+            printf("Converged in %zu iterations, relative error is %e\n", num_iters, std::sqrt(gamma / bb));
+        else
+            printf("Did not converge in %zu iterations, relative error is %e\n", max_iters, std::sqrt(gamma / bb));
+    }
+
+    delete[] r;
+    delete[] r_global;
+    delete[] w;
+    delete[] p;
+    delete[] s;
+    delete[] rows_per_processes;
+    delete[] row_offsets;
+
+    return converged;
+}
+
+// Communication-avoiding s-step conjugate gradients. Every outer step builds the Krylov bases
+// [p, A*p, ..., A^s*p] and [r, A*r, ..., A^s*r] from Chebyshev polynomials, reduces their Gram matrix
+// with a single MPI_Allreduce and then performs s CG iterations on the basis coordinates without any
+// communication. The first 2*s iterations are classic CG steps whose coefficients give Lanczos
+// estimates of the spectral interval for the Chebyshev polynomials.
+// Parameters and return value are the same as for conjugate_gradients, `s` is the number of iterations per outer step.
+bool s_step_conjugate_gradients(const double * A, const double * b, double * x, size_t local_size, size_t total_rows, size_t max_iters, double rel_error, size_t s)
+{
+    int rank, mpi_size; // MPI process rank and total number of processes
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    size_t num_iters = 0; // Counter for the number of iterations
+    size_t num_outer = 0; // Counter for the number of outer s-step iterations
+    bool converged = false;
+    double alpha, beta, rr, rr_new, bb; // Scalars for algorithm steps
+    size_t m = 2 * s + 2; // Number of basis vectors, s+1 for the search direction and s+1 for the residual
+    double * r = new double[local_size]; // Local residual vector
+    double * p_local = new double[local_size]; // Local search direction vector
+    double * Ap_local = new double[local_size]; // Local matrix-vector product result
+    double * Y = new double[local_size * m]; // Local rows of the basis, row-major
+    double * pair_local = new double[2 * local_size]; // Local rows of the two basis vectors being multiplied, interleaved
+    double * pair_global = new double[2 * total_rows]; // The same two vectors gathered from all processes
+    double * pair_product = new double[2 * local_size]; // Local rows of A times the two vectors
+    double * G_local = new double[m * m]; // Local part of the Gram matrix Y^T*Y
+    double * G = new double[m * m]; // Gram matrix of the basis
+    double * B = new double[m * m]; // Change of basis matrix, A*Y[:, k] = Y*B[:, k] for all but the last column of each block
+    double * x_coords = new double[m]; // Coordinates of the solution update in the basis
+    double * r_coords = new double[m]; // Coordinates of the residual in the basis
+    double * p_coords = new double[m]; // Coordinates of the search direction in the basis
+    double * Bp_coords = new double[m]; // Coordinates of A*p in the basis
+    size_t num_warmup = std::min(2 * s, max_iters); // Number of classic CG iterations used to estimate the spectrum
+    double * lanczos_diag = new double[num_warmup + 1]; // Lanczos tridiagonal built from the CG coefficients
+    double * lanczos_offdiag = new double[num_warmup + 1];
+
+    int * rows_per_processes = new int[mpi_size]; // Number of rows handled by each process
+    int * row_offsets = new int[mpi_size]; // Starting offset of rows for each process
+    int * pair_counts = new int[mpi_size]; // Number of interleaved pair entries handled by each process
+    int * pair_offsets = new int[mpi_size]; // Starting offset of the pair entries for each process
+    compute_row_distribution(total_rows, mpi_size, rows_per_processes, row_offsets);
+    for(int i = 0; i < mpi_size; i++)
+    {
+        pair_counts[i] = 2 * rows_per_processes[i];
+        pair_offsets[i] = 2 * row_offsets[i];
+    }
+
+    // Initialize x to zero and r and p to b
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < local_size; i++)
+    {
+        x[i] = 0.0;
+        r[i] = b[i];
+        p_local[i] = b[i];
+    }
+
+    bb = dotP(b, b, local_size);
+    rr = bb;
+
+    // Classic CG iterations, their coefficients form the Lanczos tridiagonal matrix
+    double alpha_old = 0.0, beta_old = 0.0;
+    size_t num_lanczos = 0;
+    while(num_iters < num_warmup)
+    {
+        num_iters++;
+        MPI_Allgatherv(p_local, local_size, MPI_DOUBLE, pair_global, rows_per_processes, row_offsets, MPI_DOUBLE, MPI_COMM_WORLD);
+        gemvP(1.0, A, pair_global, 0.0, Ap_local, local_size, total_rows);
+
+        alpha = rr / dotP(p_local, Ap_local, local_size);
+        axpbyP(alpha, p_local, 1.0, x, local_size);
+        axpbyP(-alpha, Ap_local, 1.0, r, local_size);
+
+        rr_new = dotP(r, r, local_size);
+        beta = rr_new / rr;
+        rr = rr_new;
+
+        lanczos_diag[num_lanczos] = 1.0 / alpha + (num_lanczos > 0 ? beta_old / alpha_old : 0.0);
+        lanczos_offdiag[num_lanczos] = std::sqrt(beta) / alpha;
+        num_lanczos++;
+        alpha_old = alpha;
+        beta_old = beta;
+
+        if(std::sqrt(rr / bb) < rel_error)
+        {
+            converged = true;
+            break;
+        }
+
+        axpbyP(1.0, r, beta, p_local, local_size);
+    }
+
+    // Chebyshev polynomials shifted and scaled to the estimated spectral interval
+    double eig_min = 1.0, eig_max = 1.0;
+    if(num_lanczos > 0)
+        tridiagonal_extreme_eigenvalues(lanczos_diag, lanczos_offdiag, num_lanczos, &eig_min, &eig_max);
+    double center = 0.5 * (eig_max + eig_min);
+    double half_width = std::fmax(0.5 * (eig_max - eig_min), 0.5 * center);
+
+    // Three-term recurrence of the Chebyshev basis in each of the two blocks:
+    // A*v_0 = c*v_0 + h*v_1 and A*v_k = h/2*v_(k-1) + c*v_k + h/2*v_(k+1)
+    for(size_t i = 0; i < m * m; i++)
+    {
+        B[i] = 0.0;
+    }
+    for(size_t block = 0; block < m; block += s + 1)
+    {
+        B[block * m + block] = center;
+        B[(block + 1) * m + block] = half_width;
+        for(size_t k = 1; k < s; k++)
+        {
+            B[(block + k - 1) * m + block + k] = 0.5 * half_width;
+            B[(block + k) * m + block + k] = center;
+            B[(block + k + 1) * m + block + k] = 0.5 * half_width;
+        }
+    }
+
+    while(!converged && num_iters < max_iters)
+    {
+        num_outer++;
+
+        // Matrix powers kernel, both blocks are advanced with a single pass over the matrix per degree
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            Y[i * m] = p_local[i];
+            Y[i * m + s + 1] = r[i];
+        }
+        for(size_t j = 0; j < s; j++)
+        {
+            #pragma omp parallel for schedule(static)
+            for(size_t i = 0; i < local_size; i++)
+            {
+                pair_local[2 * i] = Y[i * m + j];
+                pair_local[2 * i + 1] = Y[i * m + s + 1 + j];
+            }
+            MPI_Allgatherv(pair_local, 2 * local_size, MPI_DOUBLE, pair_global, pair_counts, pair_offsets, MPI_DOUBLE, MPI_COMM_WORLD);
+            gemmP(A, pair_global, pair_product, local_size, total_rows, 2);
+
+            #pragma omp parallel for schedule(static)
+            for(size_t i = 0; i < local_size; i++)
+            {
+                for(size_t half = 0; half < 2; half++)
+                {
+                    double * y_row = Y + i * m + half * (s + 1);
+                    double v_prev = (j > 0) ? y_row[j - 1] : 0.0;
+                    double scale = (j > 0) ? 2.0 : 1.0;
+                    y_row[j + 1] = scale * (pair_product[2 * i + half] - center * y_row[j]) / half_width - v_prev;
+                }
+            }
+        }
+
+        // Gram matrix of the basis, the only reduction of the outer step
+        for(size_t k = 0; k < m * m; k++)
+        {
+            G_local[k] = 0.0;
+        }
+        #pragma omp parallel for schedule(static) reduction(+:G_local[:m * m])
+        for(size_t i = 0; i < local_size; i++)
+        {
+            const double * y_row = Y + i * m;
+            for(size_t k = 0; k < m; k++)
+            {
+                for(size_t l = k; l < m; l++)
+                {
+                    G_local[k * m + l] += y_row[k] * y_row[l];
+                }
+            }
+        }
+        MPI_Allreduce(G_local, G, m * m, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        for(size_t k = 0; k < m; k++)
+        {
+            for(size_t l = 0; l < k; l++)
+            {
+                G[k * m + l] = G[l * m + k];
+            }
+        }
+
+        // s iterations of CG on the coordinates, inner products use the Gram matrix
+        for(size_t k = 0; k < m; k++)
+        {
+            x_coords[k] = r_coords[k] = p_coords[k] = 0.0;
+        }
+        p_coords[0] = 1.0;
+        r_coords[s + 1] = 1.0;
+        rr = G[(s + 1) * m + s + 1];
+
+        for(size_t j = 0; j < s && num_iters < max_iters; j++)
+        {
+            num_iters++;
+
+            for(size_t k = 0; k < m; k++)
+            {
+                Bp_coords[k] = 0.0;
+                for(size_t l = 0; l < m; l++)
+                {
+                    Bp_coords[k] += B[k * m + l] * p_coords[l];
+                }
+            }
+
+            double pAp = 0.0;
+            for(size_t k = 0; k < m; k++)
+            {
+                for(size_t l = 0; l < m; l++)
+                {
+                    pAp += p_coords[k] * G[k * m + l] * Bp_coords[l];
+                }
+            }
+
+            alpha = rr / pAp;
+            for(size_t k = 0; k < m; k++)
+            {
+                x_coords[k] += alpha * p_coords[k];
+                r_coords[k] -= alpha * Bp_coords[k];
+            }
+
+            rr_new = 0.0;
+            for(size_t k = 0; k < m; k++)
+            {
+                for(size_t l = 0; l < m; l++)
+                {
+                    rr_new += r_coords[k] * G[k * m + l] * r_coords[l];
+                }
+            }
+            beta = rr_new / rr;
+            rr = rr_new;
+
+            if(std::sqrt(rr / bb) < rel_error)
+            {
+                converged = true;
+                break;
+            }
+
+            for(size_t k = 0; k < m; k++)
+            {
+                p_coords[k] = r_coords[k] + beta * p_coords[k];
+            }
+        }
+
+        // Recover the solution, residual and search direction from their coordinates
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            const double * y_row = Y + i * m;
+            double x_val = 0.0, r_val = 0.0, p_val = 0.0;
+            for(size_t k = 0; k < m; k++)
+            {
+                x_val += y_row[k] * x_coords[k];
+                r_val += y_row[k] * r_coords[k];
+                p_val += y_row[k] * p_coords[k];
+            }
+            x[i] += x_val;
+            r[i] = r_val;
+            p_local[i] = p_val;
+        }
+    }
+
+    if(rank == 0)
+    {
+        if(converged)
+            printf("Converged in %zu iterations, relative error is %e\n", num_iters, std::sqrt(rr / bb));
+        else
+            printf("Did not converge in %zu iterations, relative error is %e\n", max_iters, std::sqrt(rr / bb));
+        printf("s-step CG with s = %zu: %zu outer steps after %zu classic iterations, Chebyshev basis on [%e, %e]\n", s, num_outer, num_lanczos, eig_min, eig_max);
+    }
+
+    delete[] r;
+    delete[] p_local;
+    delete[] Ap_local;
+    delete[] Y;
+    delete[] pair_local;
+    delete[] pair_global;
+    delete[] pair_product;
+    delete[] G_local;
+    delete[] G;
+    delete[] B;
+    delete[] x_coords;
+    delete[] r_coords;
+    delete[] p_coords;
+    delete[] Bp_coords;
+    delete[] lanczos_diag;
+    delete[] lanczos_offdiag;
+    delete[] rows_per_processes;
+    delete[] row_offsets;
+    delete[] pair_counts;
+    delete[] pair_offsets;
+
+    return converged;
+}
+
+// Conjugate gradients with the matrix distributed over a square q x q process grid. The process in
+// grid row i and grid column j holds the block A_ij, and the vectors of row block i are replicated over
+// grid row i. A matrix-vector product swaps vector blocks with the transposed process (j,i) and sums
+// the partial products over the grid row, so each process communicates O(n/q) values per iteration.
+// `A` is the local block of `block_rows` x `block_cols`, `b` and `x` are the vectors of the local row block.
+// Returns true if the method converged.
+bool conjugate_gradients_2d(const double * A, const double * b, double * x, size_t block_rows, size_t block_cols, MPI_Comm grid_comm, size_t max_iters, double rel_error)
+{
+    int rank, grid_coords[2], transposed_coords[2], transposed_rank;
+    MPI_Comm_rank(grid_comm, &rank);
+    MPI_Cart_coords(grid_comm, rank, 2, grid_coords);
+    transposed_coords[0] = grid_coords[1];
+    transposed_coords[1] = grid_coords[0];
+    MPI_Cart_rank(grid_comm, transposed_coords, &transposed_rank);
+
+    // Communicators along the grid row (sums of partial products) and the grid column (dot products)
+    MPI_Comm row_comm, col_comm;
+    int keep_col[2] = {0, 1};
+    int keep_row[2] = {1, 0};
+    MPI_Cart_sub(grid_comm, keep_col, &row_comm);
+    MPI_Cart_sub(grid_comm, keep_row, &col_comm);
+
+    size_t num_iters; // Counter for the number of iterations
+    double alpha, beta, rr, rr_new, bb, pAp; // Scalars for algorithm steps
+    double local_dot;
+    double * r = new double[block_rows]; // Residual of the local row block
+    double * p = new double[block_rows]; // Search direction of the local row block
+    double * p_col = new double[block_cols]; // Search direction of the local column block
+    double * Ap_partial = new double[block_rows]; // Product of the local block with p_col
+    double * Ap = new double[block_rows]; // Matrix-vector product of the local row block
+
+    // Initialize x to zero and r and p to b
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < block_rows; i++)
+    {
+        x[i] = 0.0;
+        r[i] = b[i];
+        p[i] = b[i];
+    }
+
+    // The vectors are replicated over the grid row, so the dot products are reduced over the grid column only
+    local_dot = 0.0;
+    #pragma omp parallel for schedule(static) reduction(+:local_dot)
+    for(size_t i = 0; i < block_rows; i++)
+    {
+        local_dot += b[i] * b[i];
+    }
+    MPI_Allreduce(&local_dot, &bb, 1, MPI_DOUBLE, MPI_SUM, col_comm);
+    rr = bb;
+
+    // Main iteration loop
+    for(num_iters = 1; num_iters <= max_iters; num_iters++)
+    {
+        // Row block i of p becomes column block i at the transposed process
+        MPI_Sendrecv(p, block_rows, MPI_DOUBLE, transposed_rank, 0, p_col, block_cols, MPI_DOUBLE, transposed_rank, 0, grid_comm, MPI_STATUS_IGNORE);
+        gemvP(1.0, A, p_col, 0.0, Ap_partial, block_rows, block_cols);
+        MPI_Allreduce(Ap_partial, Ap, block_rows, MPI_DOUBLE, MPI_SUM, row_comm);
+
+        local_dot = 0.0;
+        #pragma omp parallel for schedule(static) reduction(+:local_dot)
+        for(size_t i = 0; i < block_rows; i++)
+        {
+            local_dot += p[i] * Ap[i];
+        }
+        MPI_Allreduce(&local_dot, &pAp, 1, MPI_DOUBLE, MPI_SUM, col_comm);
+
+        alpha = rr / pAp;
+        axpbyP(alpha, p, 1.0, x, block_rows);
+        axpbyP(-alpha, Ap, 1.0, r, block_rows);
+
+        local_dot = 0.0;
+        #pragma omp parallel for schedule(static) reduction(+:local_dot)
+        for(size_t i = 0; i < block_rows; i++)
+        {
+            local_dot += r[i] * r[i];
+        }
+        MPI_Allreduce(&local_dot, &rr_new, 1, MPI_DOUBLE, MPI_SUM, col_comm);
+
+        beta = rr_new / rr;
+        rr = rr_new;
+
+        // Check for convergence
+        if(std::sqrt(rr / bb) < rel_error)
+            break;
+
+        axpbyP(1.0, r, beta, p, block_rows);
+    }
+
+    if(rank == 0)
+    {
+        if(num_iters <= max_iters)
+            printf("Converged in %zu iterations, relative error is %e\n", num_iters, std::sqrt(rr / bb));
+        else
+            printf("Did not converge in %zu iterations, relative error is %e\n", max_iters, std::sqrt(rr / bb));
+    }
+
+    delete[] r;
+    delete[] p;
+    delete[] p_col;
+    delete[] Ap_partial;
+    delete[] Ap;
+    MPI_Comm_free(&row_comm);
+    MPI_Comm_free(&col_comm);
+
+    return num_iters <= max_iters;
+}
+
+// Reads, solves and writes the system with the matrix distributed over a square process grid,
+// see conjugate_gradients_2d. Returns the exit code of the program.
+int solve_with_2d_distribution(const char * input_file_matrix, const char * input_file_rhs, const char * output_file_sol, size_t max_iters, double rel_error)
+{
+    int rank, mpi_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    int grid_size = (int)std::lround(std::sqrt((double)mpi_size));
+    if(grid_size * grid_size != mpi_size)
+    {
+        if(rank == 0)
+            fprintf(stderr, "The 2d distribution needs a square number of processes\n");
+        return 8;
+    }
+
+    MPI_Comm grid_comm;
+    int dims[2] = {grid_size, grid_size};
+    int periods[2] = {0, 0};
+    int grid_coords[2];
+    MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 0, &grid_comm);
+    MPI_Cart_coords(grid_comm, rank, 2, grid_coords);
+
+    if(rank == 0)
+        printf("Reading matrix right hand side from file\n\n");
+
+    double * matrix;
+    double * rhs;
+    size_t block_rows, block_cols, row_begin, col_begin, total_rows, total_cols;
+    size_t rhs_rows, rhs_cols, rhs_row_begin, rhs_col_begin, rhs_total_rows, rhs_total_cols;
+    bool success_read_matrix = read_matrix_block_from_file(input_file_matrix, grid_size, grid_size, grid_coords[0], grid_coords[1], &matrix, &block_rows, &block_cols, &row_begin, &col_begin, &total_rows, &total_cols);
+    bool success_read_rhs = read_matrix_block_from_file(input_file_rhs, grid_size, 1, grid_coords[0], 0, &rhs, &rhs_rows, &rhs_cols, &rhs_row_begin, &rhs_col_begin, &rhs_total_rows, &rhs_total_cols);
+
+    if(rank == 0)
+        printf("Done\n\n");
+
+    if(!success_read_matrix){
+        fprintf(stderr, "Failed to read matrix\n");
+        return 1;
+    }
+    if(!success_read_rhs){
+        fprintf(stderr, "Failed to read rhs\n");
+        return 2;
+    }
+    if(rhs_total_rows != total_rows)
+    {
+        fprintf(stderr, "Size of right hand side does not match the matrix\n");
+        return 4;
+    }
+    if(rhs_total_cols != 1)
+    {
+        fprintf(stderr, "Right hand side has to have just a single column\n");
+        return 5;
+    }
+
+    if(rank == 0)
+        printf("Process grid %d x %d, local blocks of about %zu x %zu\n\n", grid_size, grid_size, block_rows, block_cols);
+
+    double * sol = new double[block_rows];
+    double start_time = MPI_Wtime();
+
+    bool converged = conjugate_gradients_2d(matrix, rhs, sol, block_rows, block_cols, grid_comm, max_iters, rel_error);
+
+    double end_time = MPI_Wtime();
+    double elapsed_time = end_time - start_time;
+
+    // The solution is replicated over the grid row, the first grid column writes it
+    if(converged)
+        write_solution_to_file(output_file_sol, sol, (grid_coords[1] == 0) ? block_rows : 0, row_begin);
+
+    if(rank == 0)
+        printf("Finished successfully. Time taken to solve the sistem of size %zu: %f seconds", total_rows, elapsed_time);
+
+    delete[] matrix;
+    delete[] rhs;
+    delete[] sol;
+    MPI_Comm_free(&grid_comm);
+
+    return 0;
+}
+
+// Splits the rows so that every process stores about the same number of elements of the upper
+// triangle, rows near the top are longer so the first processes get fewer of them
+void compute_triangle_row_distribution(size_t total_rows, int mpi_size, int * rows_per_processes, int * row_offsets)
+{
+    double total_elements = 0.5 * (double)total_rows * (double)(total_rows + 1);
+    double stored_elements = 0.0;
+    int process = 0;
+    row_offsets[0] = 0;
+    for(size_t i = 0; i < total_rows && process < mpi_size - 1; i++)
+    {
+        stored_elements += (double)(total_rows - i);
+        if(stored_elements >= total_elements * (process + 1) / mpi_size)
+        {
+            process++;
+            row_offsets[process] = i + 1;
+        }
+    }
+    for(process++; process < mpi_size; process++)
+    {
+        row_offsets[process] = total_rows;
+    }
+    for(int k = 0; k < mpi_size; k++)
+    {
+        rows_per_processes[k] = ((k + 1 < mpi_size) ? row_offsets[k + 1] : (int)total_rows) - row_offsets[k];
+    }
+}
+
+// Reads `num_rows` rows starting at `row_begin` of the matrix in the file, the size of the whole matrix is returned
+bool read_matrix_rows_from_file(const char * filename, size_t row_begin, size_t num_rows, double ** matrix_out, size_t * total_rows_out, size_t * total_cols_out)
+{
+    size_t total_rows, total_cols;
+    FILE * file = fopen(filename, "rb");
+    if(file == nullptr)
+        return false;
+
+    if(fread(&total_rows, sizeof(size_t), 1, file) != 1 || fread(&total_cols, sizeof(size_t), 1, file) != 1
+       || !check_dense_matrix_file_size(filename, file, total_rows, total_cols))
+    {
+        fclose(file);
+        return false;
+    }
+
+    double * matrix = new double[num_rows * total_cols];
+    bool success = row_begin + num_rows <= total_rows;
+    if(success)
+    {
+        fseek(file, row_begin * total_cols * sizeof(double), SEEK_CUR);
+        success = fread(matrix, sizeof(double), num_rows * total_cols, file) == num_rows * total_cols;
+    }
+
+    fclose(file);
+
+    *matrix_out = matrix;
+    *total_rows_out = total_rows;
+    *total_cols_out = total_cols;
+
+    return success;
+}
+
+// Reads the upper triangle of the local rows of a symmetric matrix stored densely in the file.
+// Rows are distributed by compute_triangle_row_distribution, local row i keeps the columns from
+// the diagonal to the end starting at `matrix[row_starts[i]]`.
+bool read_packed_matrix_from_file(const char * filename, double ** matrix_out, size_t ** row_starts_out, size_t * row_begin_out, size_t * num_rows_out, size_t * total_rows_out, size_t * total_cols_out)
+{
+    int rank, mpi_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+    size_t total_rows, total_cols;
+    FILE * file = fopen(filename, "rb");
+    if(file == nullptr)
+        return false;
+
+    if(fread(&total_rows, sizeof(size_t), 1, file) != 1 || fread(&total_cols, sizeof(size_t), 1, file) != 1
+       || !check_dense_matrix_file_size(filename, file, total_rows, total_cols))
+    {
+        fclose(file);
+        return false;
+    }
+
+    int * rows_per_processes = new int[mpi_size];
+    int * row_offsets = new int[mpi_size];
+    compute_triangle_row_distribution(total_rows, mpi_size, rows_per_processes, row_offsets);
+    size_t row_begin = row_offsets[rank];
+    size_t num_rows = rows_per_processes[rank];
+    delete[] rows_per_processes;
+    delete[] row_offsets;
+
+    size_t * row_starts = new size_t[num_rows + 1];
+    row_starts[0] = 0;
+    for(size_t r = 0; r < num_rows; r++)
+    {
+        row_starts[r + 1] = row_starts[r] + (total_cols - (row_begin + r));
+    }
+
+    // Skip the lower triangle of every row
+    double * matrix = new double[row_starts[num_rows]];
+    bool success = total_rows == total_cols;
+    for(size_t r = 0; r < num_rows && success; r++)
+    {
+        size_t i = row_begin + r;
+        long offset = 2 * sizeof(size_t) + (i * total_cols + i) * sizeof(double);
+        success = fseek(file, offset, SEEK_SET) == 0 && fread(matrix + row_starts[r], sizeof(double), total_cols - i, file) == total_cols - i;
+    }
+
+    fclose(file);
+
+    *matrix_out = matrix;
+    *row_starts_out = row_starts;
+    *row_begin_out = row_begin;
+    *num_rows_out = num_rows;
+    *total_rows_out = total_rows;
+    *total_cols_out = total_cols;
+
+    return success;
+}
+
+// y = A*x for the local rows of a symmetric matrix in packed upper triangular storage (see
+// read_packed_matrix_from_file). Every stored element a_ij contributes a_ij*x_j to y_i and
+// a_ij*x_i to y_j, so `y` receives partial sums for all rows from `row_begin` to the end and
+// still has to be summed over the processes. `thread_buffers` holds total_rows values per thread.
+void symv_packedP(const double * A, const size_t * row_starts, const double * x, double * y, double * thread_buffers, size_t row_begin, size_t num_rows, size_t total_rows)
+{
+    #pragma omp parallel
+    {
+        double * buffer = thread_buffers + omp_get_thread_num() * total_rows;
+        for(size_t j = row_begin; j < total_rows; j++)
+        {
+            buffer[j] = 0.0;
+        }
+
+        // Rows get shorter towards the bottom, so they are handed out dynamically
+        #pragma omp for schedule(dynamic, 16)
+        for(size_t r = 0; r < num_rows; r++)
+        {
+            size_t i = row_begin + r;
+            const double * a_row = A + row_starts[r] - i;
+            double x_i = x[i];
+            double y_val = a_row[i] * x_i;
+            #pragma omp simd reduction(+:y_val)
+            for(size_t j = i + 1; j < total_rows; j++)
+            {
+                y_val += a_row[j] * x[j];
+                buffer[j] += a_row[j] * x_i;
+            }
+            buffer[i] += y_val;
+        }
+
+        // Sum the contributions of all threads
+        int num_threads = omp_get_num_threads();
+        #pragma omp for schedule(static)
+        for(size_t j = 0; j < total_rows; j++)
+        {
+            double y_val = 0.0;
+            if(j >= row_begin)
+            {
+                for(int t = 0; t < num_threads; t++)
+                {
+                    y_val += thread_buffers[t * total_rows + j];
+                }
+            }
+            y[j] = y_val;
+        }
+    }
+}
+
+// Local rows of a dense matrix file that stay on disk and are streamed through two buffers for every
+// product, so the matrix may be larger than the memory of all the processes together. While one chunk
+// of rows is multiplied, an asynchronous read fills the other buffer with the next chunk, and the read
+// of the first chunk of the next product overlaps the reductions of the iteration.
+struct streamed_matrix
+{
+    int fd;
+    size_t num_rows, num_cols;
+    off_t data_offset; // File offset of the first local row
+    size_t chunk_rows; // Rows read by one request
+    size_t num_chunks;
+    size_t next_chunk; // Chunk read by the pending request
+    int current; // Buffer of the pending request
+    double * buffers[2];
+    aiocb requests[2];
+    double wait_time; // Time spent waiting for reads that were not done when their chunk was needed
+    size_t bytes_read;
+};
+
+// Starts the asynchronous read of chunk `chunk` into buffer `buffer`
+bool post_chunk_read(streamed_matrix * S, size_t chunk, int buffer)
+{
+    size_t first_row = chunk * S->chunk_rows;
+    size_t num_rows = std::min(S->chunk_rows, S->num_rows - first_row);
+
+    aiocb * request = &S->requests[buffer];
+    memset(request, 0, sizeof(aiocb));
+    request->aio_fildes = S->fd;
+    request->aio_buf = S->buffers[buffer];
+    request->aio_nbytes = num_rows * S->num_cols * sizeof(double);
+    request->aio_offset = S->data_offset + first_row * S->num_cols * sizeof(double);
+    return aio_read(request) == 0;
+}
+
+// Waits for the read into buffer `buffer`, a short read is completed synchronously
+bool wait_chunk_read(streamed_matrix * S, int buffer)
+{
+    aiocb * request = &S->requests[buffer];
+    double wait_start = MPI_Wtime();
+    while(aio_error(request) == EINPROGRESS)
+    {
+        const aiocb * requests[1] = {request};
+        aio_suspend(requests, 1, nullptr);
+    }
+    ssize_t num_bytes = aio_return(request);
+    if(num_bytes < 0)
+        return false;
+
+    size_t done = num_bytes;
+    while(done < request->aio_nbytes)
+    {
+        ssize_t rest = pread(S->fd, (char *)request->aio_buf + done, request->aio_nbytes - done, request->aio_offset + done);
+        if(rest <= 0)
+            return false;
+        done += rest;
+    }
+    S->wait_time += MPI_Wtime() - wait_start;
+    S->bytes_read += done;
+    return true;
+}
+
+// Opens the matrix file for streaming the rows of the process in chunks of about `chunk_bytes` bytes
+// and starts the read of the first chunk. The rows are distributed as by read_matrix_from_file.
+bool setup_streamed_matrix(const char * filename, size_t chunk_bytes, streamed_matrix * S, size_t * row_begin_out, size_t * total_rows_out)
+{
+    int rank, mpi_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    size_t header[2]; // Total number of rows and columns
+    struct stat file_stat;
+    S->fd = open(filename, O_RDONLY);
+    if(S->fd < 0)
+        return false;
+    if(pread(S->fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) || fstat(S->fd, &file_stat) != 0
+       || !check_dense_matrix_file_size(filename, file_stat.st_size, header[0], header[1]))
+    {
+        close(S->fd);
+        return false;
+    }
+
+    size_t total_rows = header[0];
+    size_t row_begin = rank * (total_rows / mpi_size);
+    S->num_cols = header[1];
+    S->num_rows = total_rows / mpi_size;
+    if(rank == mpi_size - 1) { S->num_rows += total_rows % mpi_size; }
+    S->data_offset = sizeof(header) + row_begin * S->num_cols * sizeof(double);
+
+    S->chunk_rows = std::max(chunk_bytes / (S->num_cols * sizeof(double)), (size_t)1);
+    S->chunk_rows = std::min(S->chunk_rows, std::max(S->num_rows, (size_t)1));
+    S->num_chunks = (S->num_rows + S->chunk_rows - 1) / S->chunk_rows;
+    S->buffers[0] = new double[S->chunk_rows * S->num_cols];
+    S->buffers[1] = new double[S->chunk_rows * S->num_cols];
+    S->next_chunk = 0;
+    S->current = 0;
+    S->wait_time = 0.0;
+    S->bytes_read = 0;
+
+    *row_begin_out = row_begin;
+    *total_rows_out = total_rows;
+
+    return S->num_chunks == 0 || post_chunk_read(S, 0, 0);
+}
+
+void free_streamed_matrix(streamed_matrix * S)
+{
+    // The pending request still writes into its buffer
+    if(S->num_chunks > 0)
+        wait_chunk_read(S, S->current);
+    close(S->fd);
+    delete[] S->buffers[0];
+    delete[] S->buffers[1];
+}
+
+// y = A*x for the streamed local rows of A. Every chunk is multiplied by gemvP while the read of the
+// following chunk, or of the first chunk of the next product, is in flight.
+void streamed_gemvP(streamed_matrix * S, const double * x, double * y)
+{
+    for(size_t c = 0; c < S->num_chunks; c++)
+    {
+        int buffer = S->current;
+        size_t chunk = S->next_chunk;
+        if(!wait_chunk_read(S, buffer))
+        {
+            fprintf(stderr, "Failed to read rows of the streamed matrix\n");
+            MPI_Abort(MPI_COMM_WORLD, 3);
+        }
+
+        S->next_chunk = (chunk + 1) % S->num_chunks;
+        S->current = 1 - buffer;
+        if(!post_chunk_read(S, S->next_chunk, S->current))
+        {
+            fprintf(stderr, "Failed to start reading rows of the streamed matrix\n");
+            MPI_Abort(MPI_COMM_WORLD, 3);
+        }
+
+        size_t first_row = chunk * S->chunk_rows;
+        size_t num_rows = std::min(S->chunk_rows, S->num_rows - first_row);
+        gemvP(1.0, S->buffers[buffer], x, 0.0, y + first_row, num_rows, S->num_cols);
+    }
+}
+
+// Rows of a sparse matrix in compressed sparse row format
+struct csr_matrix
+{
+    size_t num_rows;
+    size_t * row_starts; // num_rows + 1 offsets of the rows in columns and values
+    size_t * columns;
+    double * values;
+};
+
+// Rows of a sparse matrix in the SELL-C-sigma format of Kreutzer et al.: the rows are sorted by length
+// within windows of sigma rows and grouped into chunks of C rows, and every chunk is padded to its longest
+// row and stored column by column, so the C rows of a chunk fill the lanes of a SIMD register
+struct sell_matrix
+{
+    size_t num_rows;
+    size_t chunk_height; // C, a multiple of the SIMD width
+    size_t num_chunks;
+    size_t * chunk_starts; // num_chunks + 1 offsets of the chunks in columns and values
+    uint32_t * columns; // 32 bit indices halve the index traffic and allow the narrower gathers
+    double * values;
+    size_t * row_order; // Row of the matrix stored at every sorted position
+};
+
+// Largest chunk height supported by sell_spmvP
+const size_t SELL_MAX_CHUNK_HEIGHT = 64;
+
+// Converts the CSR rows to SELL-C-sigma with chunk height `chunk_height` and sorting window `sigma`,
+// returns the number of stored entries including the padding
+size_t csr_to_sell(const csr_matrix * A, size_t chunk_height, size_t sigma, sell_matrix * S)
+{
+    size_t num_rows = A->num_rows;
+    size_t C = chunk_height;
+    S->num_rows = num_rows;
+    S->chunk_height = C;
+    S->num_chunks = (num_rows + C - 1) / C;
+    S->row_order = new size_t[num_rows];
+    S->chunk_starts = new size_t[S->num_chunks + 1];
+
+    // Sort the rows by decreasing length within every window, which keeps the padding small while
+    // staying close to the original order of the vector entries
+    for(size_t r = 0; r < num_rows; r++)
+    {
+        S->row_order[r] = r;
+    }
+    for(size_t w = 0; w < num_rows; w += sigma)
+    {
+        size_t w_end = std::min(w + sigma, num_rows);
+        std::stable_sort(S->row_order + w, S->row_order + w_end, [&](size_t a, size_t b) { return A->row_starts[a + 1] - A->row_starts[a] > A->row_starts[b + 1] - A->row_starts[b]; });
+    }
+
+    S->chunk_starts[0] = 0;
+    for(size_t k = 0; k < S->num_chunks; k++)
+    {
+        size_t length = 0;
+        for(size_t l = 0; l < C && k * C + l < num_rows; l++)
+        {
+            size_t r = S->row_order[k * C + l];
+            length = std::max(length, A->row_starts[r + 1] - A->row_starts[r]);
+        }
+        S->chunk_starts[k + 1] = S->chunk_starts[k] + length * C;
+    }
+
+    // Fill the chunks column by column, padding entries are zeros multiplying the first vector entry
+    size_t num_stored = S->chunk_starts[S->num_chunks];
+    S->columns = new uint32_t[num_stored];
+    S->values = new double[num_stored];
+    #pragma omp parallel for schedule(static)
+    for(size_t k = 0; k < S->num_chunks; k++)
+    {
+        size_t length = (S->chunk_starts[k + 1] - S->chunk_starts[k]) / C;
+        for(size_t l = 0; l < C; l++)
+        {
+            size_t row_length = 0, row_start = 0;
+            if(k * C + l < num_rows)
+            {
+                size_t r = S->row_order[k * C + l];
+                row_start = A->row_starts[r];
+                row_length = A->row_starts[r + 1] - row_start;
+            }
+            for(size_t j = 0; j < length; j++)
+            {
+                size_t idx = S->chunk_starts[k] + j * C + l;
+                S->columns[idx] = (j < row_length) ? (uint32_t)A->columns[row_start + j] : 0;
+                S->values[idx] = (j < row_length) ? A->values[row_start + j] : 0.0;
+            }
+        }
+    }
+
+    return num_stored;
+}
+
+void free_sell_matrix(sell_matrix * S)
+{
+    delete[] S->chunk_starts;
+    delete[] S->columns;
+    delete[] S->values;
+    delete[] S->row_order;
+}
+
+// y = A*x + beta*y for the rows of the SELL-C-sigma matrix. The inner loop runs over the C rows of a
+// chunk with unit stride, so it vectorizes with gathers of x regardless of the row lengths.
+void sell_spmvP(const sell_matrix * A, const double * x, double beta, double * y)
+{
+    size_t C = A->chunk_height;
+
+    #pragma omp parallel for schedule(static)
+    for(size_t k = 0; k < A->num_chunks; k++)
+    {
+        double sums[SELL_MAX_CHUNK_HEIGHT];
+        for(size_t l = 0; l < C; l++)
+        {
+            sums[l] = 0.0;
+        }
+
+        const uint32_t * columns = A->columns + A->chunk_starts[k];
+        const double * values = A->values + A->chunk_starts[k];
+        size_t length = (A->chunk_starts[k + 1] - A->chunk_starts[k]) / C;
+        for(size_t j = 0; j < length; j++)
+        {
+            #pragma omp simd
+            for(size_t l = 0; l < C; l++)
+            {
+                sums[l] += values[j * C + l] * x[columns[j * C + l]];
+            }
+        }
+
+        for(size_t l = 0; l < C && k * C + l < A->num_rows; l++)
+        {
+            size_t r = A->row_order[k * C + l];
+            y[r] = (beta == 0.0) ? sums[l] : beta * y[r] + sums[l];
+        }
+    }
+}
+
+// Local rows of a distributed sparse matrix, split into the part acting on the vector entries of the
+// process and the part acting on the halo, the entries owned by other processes that the rows reference
+struct distributed_csr_matrix
+{
+    csr_matrix local; // Columns numbered from the first row of the process
+    csr_matrix halo; // Columns numbered by their position in the halo
+    size_t num_halo; // Number of halo entries received every product
+    size_t num_send; // Number of entries sent every product
+    MPI_Comm neighbor_comm; // Graph communicator of the processes exchanging halo entries
+    int * send_counts; // Entries sent to and received from every neighbor
+    int * send_offsets;
+    int * recv_counts;
+    int * recv_offsets;
+    size_t * send_indices; // Local indices of the entries sent, grouped by neighbor
+    double * send_buffer;
+    double * halo_values;
+    sell_matrix * local_sell; // SELL-C-sigma copies of the two parts, used instead of the CSR parts if set
+    sell_matrix * halo_sell;
+};
+
+// Reads the rows row_begin .. row_begin + num_rows - 1 of a sparse matrix file, which holds the number of
+// rows, columns and nonzeros, the num_rows + 1 row starts, the column indices and the values. Returns false
+// with a message if the header, the file size and the row starts do not describe a square CSR matrix, so
+// that a dense matrix file given with --storage=csr is rejected instead of sizing the arrays from its values.
+bool read_csr_matrix_rows_from_file(const char * filename, size_t row_begin, size_t num_rows, csr_matrix * rows, size_t * total_rows_out, size_t * total_cols_out)
+{
+    size_t header[3] = {0, 0, 0}; // Rows, columns and nonzeros
+    rows->num_rows = num_rows;
+    rows->row_starts = nullptr;
+    rows->columns = nullptr;
+    rows->values = nullptr;
+    *total_rows_out = 0;
+    *total_cols_out = 0;
+
+    FILE * file = fopen(filename, "rb");
+    if(file == nullptr)
+        return false;
+
+    bool success = fread(header, sizeof(size_t), 3, file) == 3;
+    size_t total_rows = header[0], nnz = header[2];
+
+    // Every nonzero takes a column index and a value, which bounds nnz and the number of rows by the file
+    // size before the expected size is computed
+    fseek(file, 0, SEEK_END);
+    size_t file_size = ftell(file);
+    size_t max_entries = file_size / sizeof(size_t);
+    success = success && header[0] == header[1] && total_rows < max_entries && nnz < max_entries / 2;
+    success = success && file_size == (3 + total_rows + 1 + nnz) * sizeof(size_t) + nnz * sizeof(double);
+    success = success && row_begin + num_rows <= total_rows;
+
+    if(success)
+    {
+        rows->row_starts = new size_t[num_rows + 1];
+        fseek(file, (3 + row_begin) * sizeof(size_t), SEEK_SET);
+        success = fread(rows->row_starts, sizeof(size_t), num_rows + 1, file) == num_rows + 1;
+        for(size_t r = 0; success && r < num_rows; r++)
+        {
+            success = rows->row_starts[r] <= rows->row_starts[r + 1];
+        }
+        success = success && rows->row_starts[num_rows] <= nnz;
+    }
+    if(success)
+    {
+        size_t nnz_begin = rows->row_starts[0];
+        size_t nnz_local = rows->row_starts[num_rows] - nnz_begin;
+        rows->columns = new size_t[nnz_local];
+        rows->values = new double[nnz_local];
+
+        fseek(file, (3 + total_rows + 1 + nnz_begin) * sizeof(size_t), SEEK_SET);
+        success = fread(rows->columns, sizeof(size_t), nnz_local, file) == nnz_local;
+        fseek(file, (3 + total_rows + 1 + nnz) * sizeof(size_t) + nnz_begin * sizeof(double), SEEK_SET);
+        success = success && fread(rows->values, sizeof(double), nnz_local, file) == nnz_local;
+        for(size_t i = 0; success && i < nnz_local; i++)
+        {
+            success = rows->columns[i] < total_rows;
+        }
+
+        for(size_t r = 0; r <= num_rows; r++)
+        {
+            rows->row_starts[r] -= nnz_begin;
+        }
+    }
+
+    fclose(file);
+
+    if(!success)
+    {
+        fprintf(stderr, "%s is not a CSR file: the header, the file size, the row starts or the column indices do not describe a square sparse matrix\n", filename);
+        return false;
+    }
+
+    *total_rows_out = header[0];
+    *total_cols_out = header[1];
+
+    return true;
+}
+
+void free_csr_matrix(csr_matrix * A)
+{
+    delete[] A->row_starts;
+    delete[] A->columns;
+    delete[] A->values;
+}
+
+// Splits the local rows `rows` with global column indices into the local and halo parts of `A` and sets
+// up the halo exchange: every process tells the owners which of their entries it needs, once
+void setup_distributed_csr_matrix(const csr_matrix * rows, size_t row_begin, size_t total_rows, distributed_csr_matrix * A)
+{
+    int rank, mpi_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    size_t num_rows = rows->num_rows;
+    size_t row_end = row_begin + num_rows;
+    size_t nnz = rows->row_starts[num_rows];
+    int * rows_per_processes = new int[mpi_size];
+    int * row_offsets = new int[mpi_size];
+    compute_row_distribution(total_rows, mpi_size, rows_per_processes, row_offsets);
+
+    // Sorted distinct columns owned by other processes, which groups them by owner
+    size_t * halo_columns = new size_t[nnz];
+    size_t num_halo = 0;
+    for(size_t k = 0; k < nnz; k++)
+    {
+        if(rows->columns[k] < row_begin || rows->columns[k] >= row_end)
+            halo_columns[num_halo++] = rows->columns[k];
+    }
+    std::sort(halo_columns, halo_columns + num_halo);
+    num_halo = std::unique(halo_columns, halo_columns + num_halo) - halo_columns;
+
+    // Entries to receive from every process, the owners learn which of their entries to send
+    int * recv_counts = new int[mpi_size];
+    int * recv_offsets = new int[mpi_size];
+    int * send_counts = new int[mpi_size];
+    int * send_offsets = new int[mpi_size];
+    for(int i = 0; i < mpi_size; i++)
+    {
+        recv_counts[i] = 0;
+    }
+    for(size_t h = 0; h < num_halo; h++)
+    {
+        int owner = std::upper_bound(row_offsets, row_offsets + mpi_size, (int)halo_columns[h]) - row_offsets - 1;
+        recv_counts[owner]++;
+    }
+    MPI_Alltoall(recv_counts, 1, MPI_INT, send_counts, 1, MPI_INT, MPI_COMM_WORLD);
+    int num_send = 0;
+    for(int i = 0; i < mpi_size; i++)
+    {
+        recv_offsets[i] = (i == 0) ? 0 : recv_offsets[i - 1] + recv_counts[i - 1];
+        send_offsets[i] = num_send;
+        num_send += send_counts[i];
+    }
+    size_t * send_indices = new size_t[num_send];
+    MPI_Alltoallv(halo_columns, recv_counts, recv_offsets, mpi_datatype<size_t>(), send_indices, send_counts, send_offsets, mpi_datatype<size_t>(), MPI_COMM_WORLD);
+    for(int k = 0; k < num_send; k++)
+    {
+        send_indices[k] -= row_begin;
+    }
+
+    // Graph communicator over the neighbors only, the counts are kept in neighbor order
+    int num_sources = 0, num_destinations = 0;
+    int * sources = new int[mpi_size];
+    int * destinations = new int[mpi_size];
+    A->recv_counts = new int[mpi_size];
+    A->recv_offsets = new int[mpi_size];
+    A->send_counts = new int[mpi_size];
+    A->send_offsets = new int[mpi_size];
+    for(int i = 0; i < mpi_size; i++)
+    {
+        if(recv_counts[i] > 0)
+        {
+            A->recv_counts[num_sources] = recv_counts[i];
+            A->recv_offsets[num_sources] = recv_offsets[i];
+            sources[num_sources++] = i;
+        }
+        if(send_counts[i] > 0)
+        {
+            A->send_counts[num_destinations] = send_counts[i];
+            A->send_offsets[num_destinations] = send_offsets[i];
+            destinations[num_destinations++] = i;
+        }
+    }
+    MPI_Dist_graph_create_adjacent(MPI_COMM_WORLD, num_sources, sources, MPI_UNWEIGHTED, num_destinations, destinations, MPI_UNWEIGHTED, MPI_INFO_NULL, 0, &A->neighbor_comm);
+    A->num_halo = num_halo;
+    A->num_send = num_send;
+    A->send_indices = send_indices;
+    A->send_buffer = new double[num_send];
+    A->halo_values = new double[num_halo];
+    A->local_sell = nullptr;
+    A->halo_sell = nullptr;
+
+    // Split the rows into the local and the halo part with renumbered columns
+    A->local.num_rows = A->halo.num_rows = num_rows;
+    A->local.row_starts = new size_t[num_rows + 1];
+    A->halo.row_starts = new size_t[num_rows + 1];
+    A->local.row_starts[0] = A->halo.row_starts[0] = 0;
+    for(size_t r = 0; r < num_rows; r++)
+    {
+        size_t num_local = 0;
+        for(size_t k = rows->row_starts[r]; k < rows->row_starts[r + 1]; k++)
+        {
+            if(rows->columns[k] >= row_begin && rows->columns[k] < row_end)
+                num_local++;
+        }
+        A->local.row_starts[r + 1] = A->local.row_starts[r] + num_local;
+        A->halo.row_starts[r + 1] = A->halo.row_starts[r] + (rows->row_starts[r + 1] - rows->row_starts[r] - num_local);
+    }
+    A->local.columns = new size_t[A->local.row_starts[num_rows]];
+    A->local.values = new double[A->local.row_starts[num_rows]];
+    A->halo.columns = new size_t[A->halo.row_starts[num_rows]];
+    A->halo.values = new double[A->halo.row_starts[num_rows]];
+    #pragma omp parallel for schedule(static)
+    for(size_t r = 0; r < num_rows; r++)
+    {
+        size_t local_k = A->local.row_starts[r], halo_k = A->halo.row_starts[r];
+        for(size_t k = rows->row_starts[r]; k < rows->row_starts[r + 1]; k++)
+        {
+            size_t c = rows->columns[k];
+            if(c >= row_begin && c < row_end)
+            {
+                A->local.columns[local_k] = c - row_begin;
+                A->local.values[local_k++] = rows->values[k];
+            }
+            else
+            {
+                A->halo.columns[halo_k] = std::lower_bound(halo_columns, halo_columns + num_halo, c) - halo_columns;
+                A->halo.values[halo_k++] = rows->values[k];
+            }
+        }
+    }
+
+    delete[] rows_per_processes;
+    delete[] row_offsets;
+    delete[] halo_columns;
+    delete[] recv_counts;
+    delete[] recv_offsets;
+    delete[] send_counts;
+    delete[] send_offsets;
+    delete[] sources;
+    delete[] destinations;
+}
+
+void free_distributed_csr_matrix(distributed_csr_matrix * A)
+{
+    free_csr_matrix(&A->local);
+    free_csr_matrix(&A->halo);
+    if(A->local_sell != nullptr)
+    {
+        free_sell_matrix(A->local_sell);
+        free_sell_matrix(A->halo_sell);
+        delete A->local_sell;
+        delete A->halo_sell;
+    }
+    MPI_Comm_free(&A->neighbor_comm);
+    delete[] A->send_counts;
+    delete[] A->send_offsets;
+    delete[] A->recv_counts;
+    delete[] A->recv_offsets;
+    delete[] A->send_indices;
+    delete[] A->send_buffer;
+    delete[] A->halo_values;
+}
+
+// y = A*x + beta*y for the rows of the CSR matrix
+void csr_spmvP(const csr_matrix * A, const double * x, double beta, double * y)
+{
+    #pragma omp parallel for schedule(static)
+    for(size_t r = 0; r < A->num_rows; r++)
+    {
+        double y_val = 0.0;
+        for(size_t k = A->row_starts[r]; k < A->row_starts[r + 1]; k++)
+        {
+            y_val += A->values[k] * x[A->columns[k]];
+        }
+        y[r] = (beta == 0.0) ? y_val : beta * y[r] + y_val;
+    }
+}
+
+// Replaces the CSR parts of the distributed matrix by SELL-C-sigma copies, returns the number of stored
+// entries including the padding
+size_t convert_distributed_csr_to_sell(distributed_csr_matrix * A, size_t chunk_height, size_t sigma)
+{
+    A->local_sell = new sell_matrix;
+    A->halo_sell = new sell_matrix;
+    size_t num_stored = csr_to_sell(&A->local, chunk_height, sigma, A->local_sell) + csr_to_sell(&A->halo, chunk_height, sigma, A->halo_sell);
+    free_csr_matrix(&A->local);
+    free_csr_matrix(&A->halo);
+    A->local.row_starts = A->halo.row_starts = nullptr;
+    A->local.columns = A->halo.columns = nullptr;
+    A->local.values = A->halo.values = nullptr;
+    return num_stored;
+}
+
+// y = A*x for the local rows of the distributed sparse matrix and the local entries of x. The halo
+// entries are exchanged with the neighbors only, overlapped with the product of the local part.
+void distributed_spmvP(distributed_csr_matrix * A, const double * x, double * y)
+{
+    #pragma omp parallel for schedule(static)
+    for(size_t k = 0; k < A->num_send; k++)
+    {
+        A->send_buffer[k] = x[A->send_indices[k]];
+    }
+
+    MPI_Request request;
+    MPI_Ineighbor_alltoallv(A->send_buffer, A->send_counts, A->send_offsets, MPI_DOUBLE, A->halo_values, A->recv_counts, A->recv_offsets, MPI_DOUBLE, A->neighbor_comm, &request);
+    if(A->local_sell != nullptr)
+        sell_spmvP(A->local_sell, x, 0.0, y);
+    else
+        csr_spmvP(&A->local, x, 0.0, y);
+    MPI_Wait(&request, MPI_STATUS_IGNORE);
+    if(A->halo_sell != nullptr)
+        sell_spmvP(A->halo_sell, A->halo_values, 1.0, y);
+    else
+        csr_spmvP(&A->halo, A->halo_values, 1.0, y);
+}
+
+// Kinds of linear operators for conjugate_gradients
+enum operator_kind
+{
+    OPERATOR_DENSE, // Dense local rows of the matrix
+    OPERATOR_PACKED, // Symmetric matrix in packed upper triangular storage
+    OPERATOR_STREAMED, // Dense local rows streamed from disk in every application
+    OPERATOR_SPARSE, // Distributed CSR or SELL-C-sigma matrix
+    OPERATOR_LAPLACIAN // Matrix-free 5-point Laplacian on a rectangular grid distributed by grid rows
+};
+
+// Linear operator y = A*x on the local slices of the vectors, created by the setup_*_operator functions.
+// The matrix kinds gather the whole input vector, the sparse and stencil kinds exchange only the halo
+// entries they need from other processes. T is the floating point type of the vectors, dense operators
+// exist in every precision and the other kinds in double precision only.
+template<typename T>
+struct linear_operator
+{
+    operator_kind kind;
+    size_t local_size; // Number of local vector entries
+    size_t total_size; // Number of entries of the whole vectors
+    size_t offset; // Index of the first local entry in the whole vectors
+    int * counts; // Dense, packed and streamed, local sizes of all processes for the gather
+    int * offsets; // Dense, packed and streamed, offsets of all processes for the gather
+    T * gathered; // Dense, packed and streamed, the whole input vector
+    const T * dense; // Dense, local rows row-major
+    const double * packed; // Packed, rows as described at read_packed_matrix_from_file
+    const size_t * row_starts; // Packed
+    double * partial; // Packed, partial product of this process for all rows
+    double * thread_buffers; // Packed, per-thread partial products
+    streamed_matrix * streamed; // Streamed
+    distributed_csr_matrix * sparse; // Sparse
+    size_t grid_cols; // Laplacian, unknowns per grid row
+    size_t grid_rows; // Laplacian, grid rows of the process
+    int neighbor_below, neighbor_above; // Laplacian, owners of the adjacent grid rows, MPI_PROC_NULL at the edges
+    double * halo_below, * halo_above; // Laplacian, adjacent grid rows, zero at the edges of the domain
+};
+
+// Operator of kind `kind` with no data yet, the setup_*_operator functions fill in the rest
+template<typename T>
+linear_operator<T> * create_operator(operator_kind kind, size_t local_size, size_t total_size, size_t offset)
+{
+    linear_operator<T> * op = new linear_operator<T>;
+    op->kind = kind;
+    op->local_size = local_size;
+    op->total_size = total_size;
+    op->offset = offset;
+    op->counts = op->offsets = nullptr;
+    op->gathered = nullptr;
+    op->dense = nullptr;
+    op->packed = nullptr;
+    op->row_starts = nullptr;
+    op->partial = op->thread_buffers = nullptr;
+    op->streamed = nullptr;
+    op->sparse = nullptr;
+    op->halo_below = op->halo_above = nullptr;
+    return op;
+}
+
+// Dense local rows `A` of a matrix with `total_rows` rows and columns distributed by compute_row_distribution
+template<typename T>
+linear_operator<T> * setup_dense_operator(const T * A, size_t local_size, size_t total_rows)
+{
+    int rank, mpi_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    int * counts = new int[mpi_size];
+    int * offsets = new int[mpi_size];
+    compute_row_distribution(total_rows, mpi_size, counts, offsets);
+
+    linear_operator<T> * op = create_operator<T>(OPERATOR_DENSE, local_size, total_rows, offsets[rank]);
+    op->counts = counts;
+    op->offsets = offsets;
+    op->gathered = new T[total_rows];
+    op->dense = A;
+    return op;
+}
+
+// Symmetric matrix in packed upper triangular storage, the rows are distributed by compute_triangle_row_distribution.
+// The partial products of all processes are summed with MPI_Reduce_scatter, see symv_packedP.
+linear_operator<double> * setup_packed_operator(const double * A, const size_t * row_starts, size_t local_size, size_t row_begin, size_t total_rows)
+{
+    int mpi_size;
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    linear_operator<double> * op = create_operator<double>(OPERATOR_PACKED, local_size, total_rows, row_begin);
+    op->counts = new int[mpi_size];
+    op->offsets = new int[mpi_size];
+    compute_triangle_row_distribution(total_rows, mpi_size, op->counts, op->offsets);
+    op->gathered = new double[total_rows];
+    op->packed = A;
+    op->row_starts = row_starts;
+    op->partial = new double[total_rows];
+    op->thread_buffers = new double[(size_t)omp_get_max_threads() * total_rows];
+    return op;
+}
+
+// Local rows of a dense matrix file streamed by streamed_gemvP, `row_begin` is the first of them
+linear_operator<double> * setup_streamed_operator(streamed_matrix * S, size_t row_begin, size_t total_rows)
+{
+    int mpi_size;
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    linear_operator<double> * op = create_operator<double>(OPERATOR_STREAMED, S->num_rows, total_rows, row_begin);
+    op->counts = new int[mpi_size];
+    op->offsets = new int[mpi_size];
+    compute_row_distribution(total_rows, mpi_size, op->counts, op->offsets);
+    op->gathered = new double[total_rows];
+    op->streamed = S;
+    return op;
+}
+
+linear_operator<double> * setup_sparse_operator(distributed_csr_matrix * A, size_t local_size, size_t row_begin, size_t total_rows)
+{
+    linear_operator<double> * op = create_operator<double>(OPERATOR_SPARSE, local_size, total_rows, row_begin);
+    op->sparse = A;
+    return op;
+}
+
+// 5-point Laplacian 4*x[i][j] - x[i-1][j] - x[i+1][j] - x[i][j-1] - x[i][j+1] on the interior points of a grid,
+// with zero Dirichlet values outside. The process holds `grid_rows` consecutive rows of `grid_cols` unknowns
+// starting at grid row `row_begin` of `total_grid_rows`, the rows of lower ranks lie below.
+linear_operator<double> * setup_laplacian_operator(size_t grid_cols, size_t grid_rows, size_t row_begin, size_t total_grid_rows)
+{
+    int rank, mpi_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    linear_operator<double> * op = create_operator<double>(OPERATOR_LAPLACIAN, grid_cols * grid_rows, grid_cols * total_grid_rows, grid_cols * row_begin);
+    op->grid_cols = grid_cols;
+    op->grid_rows = grid_rows;
+    op->neighbor_below = (rank > 0) ? rank - 1 : MPI_PROC_NULL;
+    op->neighbor_above = (rank < mpi_size - 1) ? rank + 1 : MPI_PROC_NULL;
+    op->halo_below = new double[grid_cols];
+    op->halo_above = new double[grid_cols];
+    for(size_t c = 0; c < grid_cols; c++)
+    {
+        op->halo_below[c] = op->halo_above[c] = 0.0;
+    }
+    return op;
+}
+
+// Laplacian of the grid rows row_begin .. row_end - 1 of the process
+void laplacian_rowsP(const linear_operator<double> * op, const double * x, double * y, size_t row_begin, size_t row_end)
+{
+    size_t cols = op->grid_cols;
+
+    #pragma omp parallel for schedule(static)
+    for(size_t r = row_begin; r < row_end; r++)
+    {
+        const double * below = (r == 0) ? op->halo_below : x + (r - 1) * cols;
+        const double * above = (r == op->grid_rows - 1) ? op->halo_above : x + (r + 1) * cols;
+        const double * row = x + r * cols;
+        double * y_row = y + r * cols;
+
+        #pragma omp simd
+        for(size_t c = 0; c < cols; c++)
+        {
+            double west = (c > 0) ? row[c - 1] : 0.0;
+            double east = (c < cols - 1) ? row[c + 1] : 0.0;
+            y_row[c] = 4.0 * row[c] - below[c] - above[c] - west - east;
+        }
+    }
+}
+
+// Gathers the local slices of `x` of all processes into op->gathered
+template<typename T>
+void gather_operator_input(linear_operator<T> * op, const T * x)
+{
+    MPI_Allgatherv(x, op->local_size, mpi_datatype<T>(), op->gathered, op->counts, op->offsets, mpi_datatype<T>(), MPI_COMM_WORLD);
+}
+
+// y = A*x for the local slices of the vectors, only dense operators exist in other precisions than double
+template<typename T>
+void apply_operator(linear_operator<T> * op, const T * x, T * y)
+{
+    gather_operator_input(op, x);
+    gemvP<T>(1.0, op->dense, op->gathered, 0.0, y, op->local_size, op->total_size);
+}
+
+template<>
+void apply_operator<double>(linear_operator<double> * op, const double * x, double * y)
+{
+    if(op->kind == OPERATOR_DENSE)
+    {
+        gather_operator_input(op, x);
+        gemvP(1.0, op->dense, op->gathered, 0.0, y, op->local_size, op->total_size);
+    }
+    else if(op->kind == OPERATOR_PACKED)
+    {
+        gather_operator_input(op, x);
+        symv_packedP(op->packed, op->row_starts, op->gathered, op->partial, op->thread_buffers, op->offset, op->local_size, op->total_size);
+        MPI_Reduce_scatter(op->partial, y, op->counts, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    }
+    else if(op->kind == OPERATOR_STREAMED)
+    {
+        gather_operator_input(op, x);
+        streamed_gemvP(op->streamed, op->gathered, y);
+    }
+    else if(op->kind == OPERATOR_SPARSE)
+    {
+        distributed_spmvP(op->sparse, x, y);
+    }
+    else if(op->kind == OPERATOR_LAPLACIAN)
+    {
+        // Exchange the boundary grid rows with the neighbors while the inner rows are computed
+        size_t cols = op->grid_cols, rows = op->grid_rows;
+        MPI_Request requests[4];
+        MPI_Irecv(op->halo_below, cols, MPI_DOUBLE, op->neighbor_below, 0, MPI_COMM_WORLD, &requests[0]);
+        MPI_Irecv(op->halo_above, cols, MPI_DOUBLE, op->neighbor_above, 1, MPI_COMM_WORLD, &requests[1]);
+        MPI_Isend(x, cols, MPI_DOUBLE, op->neighbor_below, 1, MPI_COMM_WORLD, &requests[2]);
+        MPI_Isend(x + (rows - 1) * cols, cols, MPI_DOUBLE, op->neighbor_above, 0, MPI_COMM_WORLD, &requests[3]);
+
+        if(rows > 2)
+            laplacian_rowsP(op, x, y, 1, rows - 1);
+        MPI_Waitall(4, requests, MPI_STATUSES_IGNORE);
+        laplacian_rowsP(op, x, y, 0, 1);
+        if(rows > 1)
+            laplacian_rowsP(op, x, y, rows - 1, rows);
+    }
+}
+
+// Ap = A*p for the local slices and the dot product of p and Ap reduced over all processes. Dense
+// operators compute both in one pass over the rows with gemv_dotP.
+template<typename T>
+T operator_dotP(linear_operator<T> * op, const T * p, T * Ap)
+{
+    if(op->kind == OPERATOR_DENSE)
+    {
+        gather_operator_input(op, p);
+        return gemv_dotP<T>(op->dense, op->gathered, p, Ap, op->local_size, op->total_size);
+    }
+    apply_operator(op, p, Ap);
+    return dotP(p, Ap, op->local_size);
+}
+
+// Frees the operator and its buffers, the matrix it refers to stays with the caller
+template<typename T>
+void free_operator(linear_operator<T> * op)
+{
+    delete[] op->counts;
+    delete[] op->offsets;
+    delete[] op->gathered;
+    delete[] op->partial;
+    delete[] op->thread_buffers;
+    delete[] op->halo_below;
+    delete[] op->halo_above;
+    delete op;
+}
+
+// `op` is the linear operator of the system (see linear_operator), `b` is the local slice of the right-hand
+// side vector, `x` is the local slice of the solution vector.
+// T is the floating point type of the operator, the vectors and the whole computation.
+// Returns true if the method converged, the number of iterations is stored in `num_iters_out` if given.
+// With `checkpoint` the state is written every checkpoint->interval iterations and a run can resume from it.
+// With `initial_guess` the iterations start from the `x` given instead of zero.
+template<typename T>
+bool conjugate_gradients(linear_operator<T> * op, const T * b, T * x, size_t max_iters, double rel_error, size_t * num_iters_out = nullptr, const checkpoint_settings * checkpoint = nullptr, bool initial_guess = false)
+{
+    int rank; // MPI process rank
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    size_t local_size = op->local_size; // Number of vector entries handled by this process
+    size_t total_rows = op->total_size; // Number of entries of the whole vectors
+    size_t num_iters; // Counter for the number of iterations
+    T alpha, beta, rr, rr_new, bb; // Scalars for algorithm steps
+    T * p = new T[local_size]; // Local search direction vector
+    T * Ap = new T[local_size]; // Local operator application result
+    T * r = new T[local_size]; // Local residual vector
+
+    // Initialize x to zero unless it holds the initial guess, and r and p to b locally for each process
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < local_size; i++)
+    {
+        if(!initial_guess)
+            x[i] = 0.0;
+        r[i] = b[i];
+        p[i] = b[i];
+    }
+
+    // Compute b*b and reduce it across all processes
+    bb = dotP(b, b, local_size);
+    rr = bb; 
+
+    // r = p = b - A*x for an initial guess
+    if(initial_guess)
+    {
+        apply_operator(op, x, Ap);
+        axpbyP<T>(-1.0, Ap, 1.0, r, local_size);
+        memcpy(p, r, local_size * sizeof(T));
+        rr = dotP(r, r, local_size);
+    }
+
+    // Resume from the newest checkpoint, the iterations continue exactly as if they were not interrupted
+    size_t first_iter = 1;
+    if(checkpoint != nullptr && checkpoint->restart_filename != nullptr)
+    {
+        size_t done_iters;
+        if(read_checkpoint(checkpoint->restart_filename, x, r, p, local_size, total_rows, op->offset, &done_iters, &rr, &bb))
+        {
+            first_iter = done_iters + 1;
+            if(rank == 0)
+                printf("Resuming from the checkpoint after %zu iterations\n", done_iters);
+        }
+        else if(rank == 0)
+            printf("No valid checkpoint in %s.0 or %s.1, starting from the beginning\n", checkpoint->restart_filename, checkpoint->restart_filename);
+    }
+
+    checkpoint_writer<T> writer;
+    bool checkpointing = checkpoint != nullptr && checkpoint->filename != nullptr;
+    if(checkpointing && !open_checkpoint_writer(checkpoint->filename, local_size, total_rows, op->offset, &writer))
+    {
+        if(rank == 0)
+            fprintf(stderr, "Failed to open the checkpoint files %s.0 and %s.1, continuing without checkpoints\n", checkpoint->filename, checkpoint->filename);
+        checkpointing = false;
+    }
+
+    // Main iteration loop, an initial guess may already be accurate enough to need no iterations
+    bool initially_converged = std::sqrt(rr / bb) < rel_error;
+    for(num_iters = first_iter; num_iters <= max_iters && !initially_converged; num_iters++)
+    {
+        // Compute Ap and the dot product of p and Ap, in one pass where the operator allows it
+        alpha = rr / operator_dotP(op, p, Ap);
+
+        // Update x and r and compute the new residual norm in one sweep and reduce the result
+        rr_new = fused_updateP<T>(alpha, p, Ap, x, r, local_size);
+        beta = rr_new / rr; // Update beta
+        rr = rr_new; // Prepare for next iteration
+
+        // Check for convergence
+        if(std::sqrt(rr / bb) < rel_error)
+            break; // Exit loop if converged
+
+        // Update the search direction, the operator gathers what it needs of it
+        axpbyP<T>(1.0, r, beta, p, local_size);
+
+        if(checkpointing && num_iters % checkpoint->interval == 0)
+            start_checkpoint(&writer, x, r, p, num_iters, rr, bb);
+    }
+
+    if(initially_converged)
+        num_iters = 0;
+
+    double stall_time = 0.0;
+    if(checkpointing)
+    {
+        close_checkpoint_writer(&writer);
+        MPI_Reduce(&writer.stall_time, &stall_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    }
+
+    if(rank == 0)
+    {
+        if(num_iters <= max_iters)
+            printf("Converged in %zu iterations, relative error is %e\n", num_iters, std::sqrt(rr / bb));
+        else
+            printf("Did not converge in %zu iterations, relative error is %e\n", max_iters, std::sqrt(rr / bb));
+        if(checkpointing)
+            printf("Wrote %zu checkpoints, they stalled the iterations for %f seconds\n", writer.num_started, stall_time);
+    }
+
+    if(num_iters_out != nullptr)
+        *num_iters_out = std::min(num_iters, max_iters);
+
+    delete[] r; 
+    delete[] p; 
+    delete[] Ap; 
+
+    return num_iters <= max_iters;
+}
+
+// Reads, solves and writes the system with the matrix in packed upper triangular storage, each process
+// holding the rows given by compute_triangle_row_distribution. Half of the matrix is streamed per iteration,
+// see setup_packed_operator. Returns the exit code of the program.
+int solve_with_packed_storage(const char * input_file_matrix, const char * input_file_rhs, const char * output_file_sol, size_t max_iters, double rel_error)
+{
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if(rank == 0)
+        printf("Reading matrix right hand side from file\n\n");
+
+    double * matrix;
+    double * rhs;
+    size_t * row_starts;
+    size_t row_begin, local_size, total_rows, total_cols, rhs_total_rows, rhs_total_cols;
+    bool success_read_matrix = read_packed_matrix_from_file(input_file_matrix, &matrix, &row_starts, &row_begin, &local_size, &total_rows, &total_cols);
+    bool success_read_rhs = success_read_matrix && read_matrix_rows_from_file(input_file_rhs, row_begin, local_size, &rhs, &rhs_total_rows, &rhs_total_cols);
+
+    if(rank == 0)
+        printf("Done\n\n");
+
+    if(!success_read_matrix){
+        fprintf(stderr, "Failed to read matrix\n");
+        return 1;
+    }
+    if(!success_read_rhs){
+        fprintf(stderr, "Failed to read rhs\n");
+        return 2;
+    }
+    if(rhs_total_rows != total_rows)
+    {
+        fprintf(stderr, "Size of right hand side does not match the matrix\n");
+        return 4;
+    }
+    if(rhs_total_cols != 1)
+    {
+        fprintf(stderr, "Right hand side has to have just a single column\n");
+        return 5;
+    }
+
+    double * sol = new double[local_size];
+    double start_time = MPI_Wtime();
+
+    linear_operator<double> * op = setup_packed_operator(matrix, row_starts, local_size, row_begin, total_rows);
+    bool converged = conjugate_gradients(op, rhs, sol, max_iters, rel_error);
+
+    double end_time = MPI_Wtime();
+    double elapsed_time = end_time - start_time;
+
+    if(converged)
+        write_solution_to_file(output_file_sol, sol, local_size, row_begin);
+
+    if(rank == 0)
+        printf("Finished successfully. Time taken to solve the sistem of size %zu: %f seconds", total_rows, elapsed_time);
+
+    free_operator(op);
+    delete[] matrix;
+    delete[] row_starts;
+    delete[] rhs;
+    delete[] sol;
+
+    return 0;
+}
+
+// Solves the system with the matrix streamed from the file in every iteration, the matrix file has the
+// usual dense format and should be on a fast local scratch disk of every node. Returns the exit code of the program.
+int solve_out_of_core(const char * input_file_matrix, const char * input_file_rhs, const char * output_file_sol, size_t max_iters, double rel_error, size_t chunk_bytes)
+{
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if(rank == 0)
+        printf("Opening matrix and reading right hand side from file\n\n");
+
+    streamed_matrix S;
+    double * rhs;
+    size_t row_begin, total_rows, rhs_total_rows, rhs_total_cols;
+    bool success_read_matrix = setup_streamed_matrix(input_file_matrix, chunk_bytes, &S, &row_begin, &total_rows);
+    bool success_read_rhs = success_read_matrix && read_matrix_rows_from_file(input_file_rhs, row_begin, S.num_rows, &rhs, &rhs_total_rows, &rhs_total_cols);
+
+    if(rank == 0)
+        printf("Done\n\n");
+
+    if(!success_read_matrix){
+        fprintf(stderr, "Failed to read matrix\n");
+        return 1;
+    }
+    if(!success_read_rhs){
+        fprintf(stderr, "Failed to read rhs\n");
+        free_streamed_matrix(&S);
+        return 2;
+    }
+    if(rhs_total_rows != total_rows)
+    {
+        fprintf(stderr, "Size of right hand side does not match the matrix\n");
+        free_streamed_matrix(&S);
+        delete[] rhs;
+        return 4;
+    }
+    if(rhs_total_cols != 1)
+    {
+        fprintf(stderr, "Right hand side has to have just a single column\n");
+        free_streamed_matrix(&S);
+        delete[] rhs;
+        return 5;
+    }
+
+    if(rank == 0)
+        printf("Streaming chunks of %zu rows, %.1f MB each\n", S.chunk_rows, S.chunk_rows * S.num_cols * sizeof(double) / 1e6);
+
+    size_t local_size = S.num_rows;
+    double * sol = new double[local_size];
+    double start_time = MPI_Wtime();
+    double wait_start = S.wait_time;
+    size_t bytes_start = S.bytes_read;
+
+    linear_operator<double> * op = setup_streamed_operator(&S, row_begin, total_rows);
+    bool converged = conjugate_gradients(op, rhs, sol, max_iters, rel_error);
+
+    double end_time = MPI_Wtime();
+    double elapsed_time = end_time - start_time;
+
+    // Aggregate bandwidth of all the processes over the time of the solve of the slowest one
+    double io_local[2] = {(double)(S.bytes_read - bytes_start), S.wait_time - wait_start};
+    double io_sum[2], wait_max, solve_time;
+    MPI_Reduce(io_local, io_sum, 2, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&io_local[1], &wait_max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&elapsed_time, &solve_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if(rank == 0)
+        printf("Streamed %.1f MB at an aggregate bandwidth of %.1f MB/s, processes waited for reads at most %f of %f seconds\n", io_sum[0] / 1e6, io_sum[0] / solve_time / 1e6, wait_max, solve_time);
+
+    if(converged)
+        write_solution_to_file(output_file_sol, sol, local_size, row_begin);
+
+    if(rank == 0)
+        printf("Finished successfully. Time taken to solve the sistem of size %zu: %f seconds", total_rows, elapsed_time);
+
+    free_operator(op);
+    free_streamed_matrix(&S);
+    delete[] rhs;
+    delete[] sol;
+
+    return 0;
+}
+
+// Reads the rows of the process from the sparse matrix file and solves the system with conjugate_gradients.
+// A nonzero `sell_chunk_height` converts the matrix to SELL-C-sigma with that C and `sell_sigma` first.
+// Returns the exit code of the program.
+int solve_with_csr_storage(const char * input_file_matrix, const char * input_file_rhs, const char * output_file_sol, size_t max_iters, double rel_error, size_t sell_chunk_height = 0, size_t sell_sigma = 1)
+{
+    int rank, mpi_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    if(rank == 0)
+        printf("Reading matrix right hand side from file\n\n");
+
+    // The total number of rows is needed for the row distribution before the rows can be read
+    size_t total_rows = 0, total_cols, rhs_total_rows, rhs_total_cols;
+    FILE * file = fopen(input_file_matrix, "rb");
+    bool success_read_matrix = file != nullptr && fread(&total_rows, sizeof(size_t), 1, file) == 1;
+    if(file != nullptr)
+        fclose(file);
+
+    int * rows_per_processes = new int[mpi_size];
+    int * row_offsets = new int[mpi_size];
+    compute_row_distribution(total_rows, mpi_size, rows_per_processes, row_offsets);
+    size_t row_begin = row_offsets[rank], local_size = rows_per_processes[rank];
+    delete[] rows_per_processes;
+    delete[] row_offsets;
+
+    csr_matrix rows;
+    double * rhs = nullptr;
+    success_read_matrix = success_read_matrix && read_csr_matrix_rows_from_file(input_file_matrix, row_begin, local_size, &rows, &total_rows, &total_cols);
+
+    // The row starts and columns are only checked for the local rows, all processes have to agree
+    MPI_Allreduce(MPI_IN_PLACE, &success_read_matrix, 1, MPI_C_BOOL, MPI_LAND, MPI_COMM_WORLD);
+    bool success_read_rhs = success_read_matrix && read_matrix_rows_from_file(input_file_rhs, row_begin, local_size, &rhs, &rhs_total_rows, &rhs_total_cols);
+
+    if(rank == 0)
+        printf("Done\n\n");
+
+    if(!success_read_matrix){
+        fprintf(stderr, "Failed to read matrix\n");
+        return 1;
+    }
+    if(!success_read_rhs){
+        fprintf(stderr, "Failed to read rhs\n");
+        return 2;
+    }
+    if(rhs_total_rows != total_rows)
+    {
+        fprintf(stderr, "Size of right hand side does not match the matrix\n");
+        return 4;
+    }
+    if(rhs_total_cols != 1)
+    {
+        fprintf(stderr, "Right hand side has to have just a single column\n");
+        return 5;
+    }
+
+    distributed_csr_matrix matrix;
+    setup_distributed_csr_matrix(&rows, row_begin, total_rows, &matrix);
+    free_csr_matrix(&rows);
+
+    // Halo volume against the full gather of the search direction done by the dense path
+    size_t nnz_local = matrix.local.row_starts[local_size] + matrix.halo.row_starts[local_size], nnz;
+    size_t num_halo_total;
+    MPI_Reduce(&nnz_local, &nnz, 1, mpi_datatype<size_t>(), MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&matrix.num_halo, &num_halo_total, 1, mpi_datatype<size_t>(), MPI_SUM, 0, MPI_COMM_WORLD);
+    if(rank == 0)
+        printf("Sparse matrix with %zu nonzeros, every product exchanges %zu halo entries instead of gathering %zu\n", nnz, num_halo_total, total_rows * (mpi_size - 1));
+
+    if(sell_chunk_height > 0)
+    {
+        size_t stored_local = convert_distributed_csr_to_sell(&matrix, sell_chunk_height, sell_sigma), stored;
+        MPI_Reduce(&stored_local, &stored, 1, mpi_datatype<size_t>(), MPI_SUM, 0, MPI_COMM_WORLD);
+        if(rank == 0)
+            printf("SELL-%zu-%zu format stores %zu entries, %.1f%% padding\n", sell_chunk_height, sell_sigma, stored, 100.0 * (stored - nnz) / stored);
+    }
+
+    double * sol = new double[local_size];
+    double start_time = MPI_Wtime();
+
+    linear_operator<double> * op = setup_sparse_operator(&matrix, local_size, row_begin, total_rows);
+    bool converged = conjugate_gradients(op, rhs, sol, max_iters, rel_error);
+
+    double end_time = MPI_Wtime();
+    double elapsed_time = end_time - start_time;
+
+    if(converged)
+        write_solution_to_file(output_file_sol, sol, local_size, row_begin);
+
+    if(rank == 0)
+        printf("Finished successfully. Time taken to solve the sistem of size %zu: %f seconds", total_rows, elapsed_time);
+
+    free_operator(op);
+    free_distributed_csr_matrix(&matrix);
+    delete[] rhs;
+    delete[] sol;
+
+    return 0;
+}
+
+// Solves the steady state heat equation of the heat_equation program on an nx x ny grid with the
+// temperatures of its boundary: the average condition at the interior points is the 5-point Laplacian
+// system, with the boundary values moved to the right-hand side, solved with conjugate_gradients
+// without ever forming a matrix. The interior grid rows are distributed over the processes, and the
+// (ny - 2) x (nx - 2) interior temperatures are written row-major like the other solutions.
+// Returns the exit code of the program.
+int solve_heat_equation(size_t nx, size_t ny, const char * output_file_sol, size_t max_iters, double rel_error)
+{
+    int rank, mpi_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    double bc_north = 0.0, bc_south = 100.0, bc_west = 100.0, bc_east = 100.0;
+    if(nx < 3 || ny < 3 || ny - 2 < (size_t)mpi_size)
+    {
+        if(rank == 0)
+            fprintf(stderr, "The grid needs at least 3 columns and an interior row for every process\n");
+        return 1;
+    }
+
+    size_t grid_cols = nx - 2, total_grid_rows = ny - 2;
+    int * rows_per_processes = new int[mpi_size];
+    int * row_offsets = new int[mpi_size];
+    compute_row_distribution(total_grid_rows, mpi_size, rows_per_processes, row_offsets);
+    size_t grid_rows = rows_per_processes[rank], row_begin = row_offsets[rank];
+    size_t local_size = grid_rows * grid_cols;
+    delete[] rows_per_processes;
+    delete[] row_offsets;
+
+    // Right-hand side from the boundary neighbors of the interior points, y = 0 is the south boundary
+    double * rhs = new double[local_size];
+    #pragma omp parallel for schedule(static)
+    for(size_t r = 0; r < grid_rows; r++)
+    {
+        size_t y = row_begin + r + 1;
+        for(size_t c = 0; c < grid_cols; c++)
+        {
+            size_t x = c + 1;
+            double val = 0.0;
+            if(y == 1) val += bc_south;
+            if(y == ny - 2) val += bc_north;
+            if(x == 1) val += bc_west;
+            if(x == nx - 2) val += bc_east;
+            rhs[r * grid_cols + c] = val;
+        }
+    }
+
+    double * sol = new double[local_size];
+    double start_time = MPI_Wtime();
+
+    linear_operator<double> * op = setup_laplacian_operator(grid_cols, grid_rows, row_begin, total_grid_rows);
+    bool converged = conjugate_gradients(op, rhs, sol, max_iters, rel_error);
+
+    double end_time = MPI_Wtime();
+    double elapsed_time = end_time - start_time;
+
+    if(converged)
+        write_solution_to_file(output_file_sol, sol, local_size, row_begin * grid_cols);
+
+    if(rank == 0)
+        printf("Finished successfully. Time taken to solve the heat equation on the %zu x %zu grid: %f seconds", nx, ny, elapsed_time);
+
+    free_operator(op);
+    delete[] rhs;
+    delete[] sol;
+
+    return 0;
+}
+
+// Brain floating point number, the upper half of an IEEE single precision number
+struct bfloat16
+{
+    uint16_t bits;
+};
+
+inline double to_double(float value)
+{
+    return value;
+}
+
+inline double to_double(bfloat16 value)
+{
+    uint32_t bits = (uint32_t)value.bits << 16;
+    float result;
+    memcpy(&result, &bits, sizeof(float));
+    return result;
+}
+
+inline void from_double(double value, float * out)
+{
+    *out = (float)value;
+}
+
+// Rounds to the nearest bfloat16, ties to even
+inline void from_double(double value, bfloat16 * out)
+{
+    float single = (float)value;
+    uint32_t bits;
+    memcpy(&bits, &single, sizeof(float));
+    bits += 0x7FFF + ((bits >> 16) & 1);
+    out->bits = (uint16_t)(bits >> 16);
+}
+
+// Rounds the matrix to the low precision copy `A_low` in precision T
+template<typename T>
+void convert_matrix_precision(const double * A, T * A_low, size_t num_rows, size_t num_cols)
+{
+    #pragma omp parallel for schedule(static)
+    for(size_t r = 0; r < num_rows; r++)
+    {
+        for(size_t c = 0; c < num_cols; c++)
+        {
+            size_t idx = r * num_cols + c;
+            from_double(A[idx], &A_low[idx]);
+        }
+    }
+}
+
+// y = A*x with the matrix in precision T, products and sums are computed in double precision
+template<typename T>
+void gemv_low_precisionP(const T * A, const double * x, double * y, size_t num_rows, size_t num_cols)
+{
+    #pragma omp parallel for schedule(static)
+    for(size_t r = 0; r < num_rows; r++)
+    {
+        const T * a_row = A + r * num_cols;
+        double y_val = 0.0;
+        #pragma omp simd reduction(+:y_val)
+        for(size_t c = 0; c < num_cols; c++)
+        {
+            y_val += to_double(a_row[c]) * x[c];
+        }
+        y[r] = y_val;
+    }
+}
+
+// Conjugate gradients iterating with the copy `A_low` of the matrix in low precision T, while the vectors,
+// the accumulation and all updates stay in double precision. Every `replace_interval` iterations the
+// recursively updated residual is replaced by the true residual b - A*x with the double precision matrix
+// `A`, and convergence is only accepted once the true residual meets `rel_error`; if it does not, the
+// method restarts from it. Only the replacements read `A`, the iterations stream the low precision copy.
+// The other parameters and the return value are the same as for conjugate_gradients.
+template<typename T>
+bool mixed_precision_conjugate_gradients(const double * A, const T * A_low, const double * b, double * x, size_t local_size, size_t total_rows, size_t max_iters, double rel_error, size_t replace_interval)
+{
+    int rank, mpi_size; // MPI process rank and total number of processes
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    size_t num_iters; // Counter for the number of iterations
+    size_t num_replacements = 0, num_restarts = 0;
+    bool converged = false;
+    double alpha, beta, rr, rr_new, bb; // Scalars for algorithm steps
+    double * p = new double[total_rows]; // Global search direction vector
+    double * p_local = new double[local_size]; // Local search direction vector
+    double * Ap_local = new double[local_size]; // Local matrix-vector product result
+    double * r = new double[local_size]; // Local residual vector
+    double * x_global = new double[total_rows]; // Global solution, gathered for the true residual
+
+    int * rows_per_processes = new int[mpi_size]; // Number of rows handled by each process
+    int * row_offsets = new int[mpi_size]; // Starting offset of rows for each process
+    compute_row_distribution(total_rows, mpi_size, rows_per_processes, row_offsets);
+
+    double solve_start = MPI_Wtime();
+    double replace_time = 0.0; // Time of the gathers and double precision products of the replacements
+
+    // Initialize x to zero and r and p to b
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < local_size; i++)
+    {
+        x[i] = 0.0;
+        r[i] = b[i];
+        p_local[i] = b[i];
+    }
+
+    bb = dotP(b, b, local_size);
+    rr = bb;
+
+    MPI_Allgatherv(p_local, local_size, MPI_DOUBLE, p, rows_per_processes, row_offsets, MPI_DOUBLE, MPI_COMM_WORLD);
+
+    // Main iteration loop
+    for(num_iters = 1; num_iters <= max_iters; num_iters++)
+    {
+        gemv_low_precisionP(A_low, p, Ap_local, local_size, total_rows);
+
+        alpha = rr / dotP(p_local, Ap_local, local_size);
+
+        axpbyP(alpha, p_local, 1.0, x, local_size);
+        axpbyP(-alpha, Ap_local, 1.0, r, local_size);
+
+        rr_new = dotP(r, r, local_size);
+        beta = rr_new / rr;
+        rr = rr_new;
+
+        // Replace the residual periodically and before accepting convergence
+        bool recursive_converged = std::sqrt(rr / bb) < rel_error;
+        if(recursive_converged || num_iters % replace_interval == 0)
+        {
+            double replace_start = MPI_Wtime();
+            MPI_Allgatherv(x, local_size, MPI_DOUBLE, x_global, rows_per_processes, row_offsets, MPI_DOUBLE, MPI_COMM_WORLD);
+            gemvP(1.0, A, x_global, 0.0, r, local_size, total_rows);
+            replace_time += MPI_Wtime() - replace_start;
+            axpbyP(1.0, b, -1.0, r, local_size);
+            rr = dotP(r, r, local_size);
+            num_replacements++;
+
+            // Check for convergence
+            if(std::sqrt(rr / bb) < rel_error)
+            {
+                converged = true;
+                break;
+            }
+
+            // The low precision iteration cannot go further, restart from the true residual
+            if(recursive_converged)
+            {
+                beta = 0.0;
+                num_restarts++;
+            }
+        }
+
+        // Update the search direction and gather the result from all processes
+        axpbyP(1.0, r, beta, p_local, local_size);
+        MPI_Allgatherv(p_local, local_size, MPI_DOUBLE, p, rows_per_processes, row_offsets, MPI_DOUBLE, MPI_COMM_WORLD);
+    }
+
+    // The slowest process determines the times. A double precision product with its gather stands in for
+    // a double precision iteration, whose vector updates are the same as those of the low precision one.
+    double times_local[2] = {MPI_Wtime() - solve_start, replace_time};
+    double times_max[2];
+    MPI_Reduce(times_local, times_max, 2, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    if(rank == 0)
+    {
+        size_t done_iters = std::min(num_iters, max_iters);
+        if(converged)
+            printf("Converged in %zu iterations, relative error is %e\n", num_iters, std::sqrt(rr / bb));
+        else
+            printf("Did not converge in %zu iterations, relative error is %e\n", max_iters, std::sqrt(rr / bb));
+        printf("Mixed precision: %zu true residual replacements, %zu restarts\n", num_replacements, num_restarts);
+
+        // Without a replacement there is no double precision product to compare with
+        if(done_iters > 0 && num_replacements > 0)
+        {
+            double iteration_time = (times_max[0] - times_max[1]) / done_iters;
+            double product_time = times_max[1] / num_replacements;
+            printf("Low precision iterations took %f seconds each, %.2f times the %f seconds of a double precision product\n", iteration_time, iteration_time / product_time, product_time);
+            printf("The solve took %f seconds, as long as %.1f double precision products\n", times_max[0], times_max[0] / product_time);
+        }
+        else
+            printf("The solve took %f seconds, no double precision product was measured to compare with\n", times_max[0]);
+    }
+
+    delete[] p;
+    delete[] p_local;
+    delete[] Ap_local;
+    delete[] r;
+    delete[] x_global;
+    delete[] rows_per_processes;
+    delete[] row_offsets;
+
+    return converged;
+}
+
+// Makes the low precision copy of the matrix in precision T and solves the system with
+// mixed_precision_conjugate_gradients. The double precision matrix is kept for the replacements.
+template<typename T>
+bool solve_mixed_precision(const double * A, const double * b, double * x, size_t local_size, size_t total_rows, size_t max_iters, double rel_error, size_t replace_interval)
+{
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    double start_time = MPI_Wtime();
+
+    T * A_low = new T[local_size * total_rows];
+    convert_matrix_precision(A, A_low, local_size, total_rows);
+
+    if(rank == 0)
+        printf("Matrix converted to %zu byte entries in %f seconds\n", sizeof(T), MPI_Wtime() - start_time);
+
+    bool converged = mixed_precision_conjugate_gradients(A, A_low, b, x, local_size, total_rows, max_iters, rel_error, replace_interval);
+
+    delete[] A_low;
+
+    return converged;
+}
+
+// Mixed precision iterative refinement. The inner solves run conjugate_gradients entirely in single
+// precision on A*d = r to the loose tolerance `inner_rel_error`, the outer loop computes the residual
+// r = b - A*x in double precision and adds the correction d to x until the residual meets `rel_error`.
+// `max_iters` limits the total number of inner iterations, the other parameters and the return value
+// are the same as for conjugate_gradients.
+bool iterative_refinement(const double * A, const double * b, double * x, size_t local_size, size_t total_rows, size_t max_iters, double rel_error, double inner_rel_error)
+{
+    int rank; // MPI process rank
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    size_t num_outer = 0, num_inner_total = 0, num_inner;
+    bool converged = false;
+    double rr, bb, r_norm;
+    double inner_time = 0.0, outer_time = 0.0; // Time in the single precision solves and in the double precision residuals
+    double * r = new double[local_size]; // Local residual vector
+    float * A_single = new float[local_size * total_rows]; // Single precision copy of the local rows
+    float * r_single = new float[local_size]; // Normalized residual, right-hand side of the inner solve
+    float * d_single = new float[local_size]; // Correction computed by the inner solve
+
+    double start_time = MPI_Wtime();
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < local_size * total_rows; i++)
+    {
+        A_single[i] = (float)A[i];
+    }
+    linear_operator<double> * op = setup_dense_operator(A, local_size, total_rows);
+    linear_operator<float> * op_single = setup_dense_operator(A_single, local_size, total_rows);
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < local_size; i++)
+    {
+        x[i] = 0.0;
+    }
+    bb = dotP(b, b, local_size);
+    outer_time += MPI_Wtime() - start_time;
+
+    while(true)
+    {
+        // Residual of the current solution in double precision
+        start_time = MPI_Wtime();
+        apply_operator(op, x, r);
+        axpbyP(1.0, b, -1.0, r, local_size);
+        rr = dotP(r, r, local_size);
+        outer_time += MPI_Wtime() - start_time;
+
+        if(std::sqrt(rr / bb) < rel_error)
+        {
+            converged = true;
+            break;
+        }
+        if(num_inner_total >= max_iters)
+            break;
+
+        // Solve A*d = r/|r| in single precision, the normalization keeps small residuals in the float range
+        start_time = MPI_Wtime();
+        r_norm = std::sqrt(rr);
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            r_single[i] = (float)(r[i] / r_norm);
+        }
+        conjugate_gradients(op_single, r_single, d_single, max_iters - num_inner_total, inner_rel_error, &num_inner);
+        num_inner_total += num_inner;
+        num_outer++;
+
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            x[i] += r_norm * (double)d_single[i];
+        }
+        inner_time += MPI_Wtime() - start_time;
+    }
+
+    if(rank == 0)
+    {
+        if(converged)
+            printf("Iterative refinement converged in %zu outer and %zu inner iterations, relative error is %e\n", num_outer, num_inner_total, std::sqrt(rr / bb));
+        else
+            printf("Iterative refinement did not converge in %zu outer and %zu inner iterations, relative error is %e\n", num_outer, num_inner_total, std::sqrt(rr / bb));
+        printf("Time in single precision inner solves: %f seconds, in double precision residuals and setup: %f seconds\n", inner_time, outer_time);
+    }
+
+    free_operator(op);
+    free_operator(op_single);
+    delete[] r;
+    delete[] A_single;
+    delete[] r_single;
+    delete[] d_single;
+
+    return converged;
+}
+
+// Cholesky factorization M = L*L^T of the symmetric positive definite k x k row-major matrix,
+// L overwrites the lower triangle and the upper triangle is zeroed. Returns false if M is not positive definite.
+bool cholesky_factorization(double * M, size_t k)
+{
+    for(size_t j = 0; j < k; j++)
+    {
+        double diag = M[j * k + j];
+        for(size_t l = 0; l < j; l++)
+        {
+            diag -= M[j * k + l] * M[j * k + l];
+        }
+        if(!(diag > 0.0))
+            return false;
+        diag = std::sqrt(diag);
+        M[j * k + j] = diag;
+
+        // The rows below are independent, which pays off for the large blocks of block Jacobi
+        #pragma omp parallel for schedule(static) if(k - j > 256)
+        for(size_t i = j + 1; i < k; i++)
+        {
+            double val = M[i * k + j];
+            for(size_t l = 0; l < j; l++)
+            {
+                val -= M[i * k + l] * M[j * k + l];
+            }
+            M[i * k + j] = val / diag;
+        }
+        for(size_t i = 0; i < j; i++)
+        {
+            M[i * k + j] = 0.0;
+        }
+    }
+    return true;
+}
+
+// Solves L*L^T*X = B for the Cholesky factor from cholesky_factorization, B is k x num_rhs row-major and is overwritten by X
+void cholesky_solve(const double * L, double * B, size_t k, size_t num_rhs)
+{
+    for(size_t c = 0; c < num_rhs; c++)
+    {
+        for(size_t i = 0; i < k; i++)
+        {
+            double val = B[i * num_rhs + c];
+            for(size_t l = 0; l < i; l++)
+            {
+                val -= L[i * k + l] * B[l * num_rhs + c];
+            }
+            B[i * num_rhs + c] = val / L[i * k + i];
+        }
+        for(size_t i = k; i-- > 0; )
+        {
+            double val = B[i * num_rhs + c];
+            for(size_t l = i + 1; l < k; l++)
+            {
+                val -= L[l * k + i] * B[l * num_rhs + c];
+            }
+            B[i * num_rhs + c] = val / L[i * k + i];
+        }
+    }
+}
+
+// Local part of X^T*Y for the distributed local_size x k row-major blocks X and Y, reduced over all processes into `result`
+void block_dotP(const double * X, const double * Y, double * result, size_t local_size, size_t k)
+{
+    double * local_result = new double[k * k];
+    for(size_t i = 0; i < k * k; i++)
+    {
+        local_result[i] = 0.0;
+    }
+
+    #pragma omp parallel for schedule(static) reduction(+:local_result[:k * k])
+    for(size_t r = 0; r < local_size; r++)
+    {
+        const double * x_row = X + r * k;
+        const double * y_row = Y + r * k;
+        for(size_t i = 0; i < k; i++)
+        {
+            for(size_t j = 0; j < k; j++)
+            {
+                local_result[i * k + j] += x_row[i] * y_row[j];
+            }
+        }
+    }
+
+    MPI_Allreduce(local_result, result, k * k, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    delete[] local_result;
+}
+
+// Y = X*M + beta*Y for the distributed local_size x k row-major block X and the small k x k matrix M
+void block_axpbyP(const double * X, const double * M, double beta, double * Y, size_t local_size, size_t k)
+{
+    #pragma omp parallel for schedule(static)
+    for(size_t r = 0; r < local_size; r++)
+    {
+        const double * x_row = X + r * k;
+        double * y_row = Y + r * k;
+        for(size_t j = 0; j < k; j++)
+        {
+            double val = beta * y_row[j];
+            for(size_t l = 0; l < k; l++)
+            {
+                val += x_row[l] * M[l * k + j];
+            }
+            y_row[j] = val;
+        }
+    }
+}
+
+// Orthonormalizes the columns of the distributed local_size x k block W in place by two passes of
+// Cholesky QR, W_in = W_out*factor with `factor` k x k upper triangular. Returns false on breakdown.
+bool cholesky_qr(double * W, double * factor, size_t local_size, size_t k)
+{
+    double * G = new double[k * k];
+    double * pass_factor = new double[k * k];
+    bool success = true;
+
+    for(size_t i = 0; i < k * k; i++)
+    {
+        factor[i] = (i % (k + 1) == 0) ? 1.0 : 0.0;
+    }
+
+    for(int pass = 0; pass < 2 && success; pass++)
+    {
+        // W^T*W = L*L^T, then W*L^-T has orthonormal columns
+        block_dotP(W, W, G, local_size, k);
+        success = cholesky_factorization(G, k);
+        if(!success)
+            break;
+
+        #pragma omp parallel for schedule(static)
+        for(size_t r = 0; r < local_size; r++)
+        {
+            double * w_row = W + r * k;
+            for(size_t j = 0; j < k; j++)
+            {
+                double val = w_row[j];
+                for(size_t l = 0; l < j; l++)
+                {
+                    val -= G[j * k + l] * w_row[l];
+                }
+                w_row[j] = val / G[j * k + j];
+            }
+        }
+
+        // Accumulate factor = L^T * factor
+        for(size_t i = 0; i < k; i++)
+        {
+            for(size_t j = 0; j < k; j++)
+            {
+                double val = 0.0;
+                for(size_t l = 0; l < k; l++)
+                {
+                    val += G[l * k + i] * factor[l * k + j];
+                }
+                pass_factor[i * k + j] = val;
+            }
+        }
+        memcpy(factor, pass_factor, k * k * sizeof(double));
+    }
+
+    delete[] G;
+    delete[] pass_factor;
+
+    return success;
+}
+
+// Block conjugate gradients for k right-hand sides in the breakdown-free form of Dubrulle (DR-BCG),
+// which keeps an orthonormal basis of the block residual. All k search directions are multiplied by
+// the matrix in one pass with gemmP, and the search space is shared by all right-hand sides.
+// `B` and `X` are local_size x k row-major blocks, the other parameters are the same as for conjugate_gradients.
+// Returns true if all the columns converged.
+bool block_conjugate_gradients(const double * A, const double * B, double * X, size_t local_size, size_t total_rows, size_t k, size_t max_iters, double rel_error)
+{
+    int rank, mpi_size; // MPI process rank and total number of processes
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    size_t num_iters; // Counter for the number of iterations
+    bool converged = false, breakdown = false;
+    double max_error = 0.0; // Largest relative residual norm over the columns
+    double * W = new double[local_size * k]; // Orthonormal basis of the block residual, R = W*sigma
+    double * S = new double[local_size * k]; // Local block of search directions
+    double * S_global = new double[total_rows * k]; // Search directions gathered from all processes
+    double * Q = new double[local_size * k]; // Local block of A*S
+    double * sigma = new double[k * k]; // Coordinates of the block residual in W
+    double * zeta = new double[k * k]; // Triangular factor of the orthonormalization of the new residual basis
+    double * M = new double[k * k]; // S^T*A*S and its Cholesky factor
+    double * xi = new double[k * k]; // (S^T*A*S)^-1
+    double * step = new double[k * k]; // (S^T*A*S)^-1*sigma, the update of X
+    double * tmp = new double[k * k];
+    double * bb = new double[k * k]; // B^T*B, its diagonal holds the squared norms of the right-hand sides
+
+    int * rows_per_processes = new int[mpi_size]; // Number of rows handled by each process
+    int * row_offsets = new int[mpi_size]; // Starting offset of rows for each process
+    compute_row_distribution(total_rows, mpi_size, rows_per_processes, row_offsets);
+    for(int i = 0; i < mpi_size; i++)
+    {
+        rows_per_processes[i] *= k;
+        row_offsets[i] *= k;
+    }
+
+    // Initialize X to zero and the residual basis from R = B
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < local_size * k; i++)
+    {
+        X[i] = 0.0;
+        W[i] = B[i];
+    }
+    block_dotP(B, B, bb, local_size, k);
+    breakdown = !cholesky_qr(W, sigma, local_size, k);
+    memcpy(S, W, local_size * k * sizeof(double));
+
+    // Main iteration loop
+    for(num_iters = 1; num_iters <= max_iters && !breakdown; num_iters++)
+    {
+        MPI_Allgatherv(S, local_size * k, MPI_DOUBLE, S_global, rows_per_processes, row_offsets, MPI_DOUBLE, MPI_COMM_WORLD);
+        gemmP(A, S_global, Q, local_size, total_rows, k);
+
+        // xi = (S^T*A*S)^-1 and the update of X
+        block_dotP(S, Q, M, local_size, k);
+        if(!cholesky_factorization(M, k))
+        {
+            breakdown = true;
+            break;
+        }
+        for(size_t i = 0; i < k * k; i++)
+        {
+            xi[i] = (i % (k + 1) == 0) ? 1.0 : 0.0;
+        }
+        cholesky_solve(M, xi, k, k);
+        memcpy(step, sigma, k * k * sizeof(double));
+        cholesky_solve(M, step, k, k);
+
+        block_axpbyP(S, step, 1.0, X, local_size, k);
+
+        // New residual basis W = qr(W - Q*xi)
+        for(size_t i = 0; i < k * k; i++)
+        {
+            tmp[i] = -xi[i];
+        }
+        block_axpbyP(Q, tmp, 1.0, W, local_size, k);
+        if(!cholesky_qr(W, zeta, local_size, k))
+        {
+            breakdown = true;
+            break;
+        }
+
+        // sigma = zeta*sigma, the column norms of sigma are the residual norms
+        for(size_t i = 0; i < k; i++)
+        {
+            for(size_t j = 0; j < k; j++)
+            {
+                double val = 0.0;
+                for(size_t l = 0; l < k; l++)
+                {
+                    val += zeta[i * k + l] * sigma[l * k + j];
+                }
+                tmp[i * k + j] = val;
+            }
+        }
+        memcpy(sigma, tmp, k * k * sizeof(double));
+
+        max_error = 0.0;
+        for(size_t j = 0; j < k; j++)
+        {
+            double rr = 0.0;
+            for(size_t i = 0; i < k; i++)
+            {
+                rr += sigma[i * k + j] * sigma[i * k + j];
+            }
+            max_error = std::fmax(max_error, std::sqrt(rr / bb[j * k + j]));
+        }
+
+        // Check for convergence of all the columns
+        if(max_error < rel_error)
+        {
+            converged = true;
+            break;
+        }
+
+        // S = W + S*zeta^T
+        for(size_t i = 0; i < k; i++)
+        {
+            for(size_t j = 0; j < k; j++)
+            {
+                tmp[i * k + j] = zeta[j * k + i];
+            }
+        }
+        block_axpbyP(S, tmp, 0.0, Q, local_size, k);
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < local_size * k; i++)
+        {
+            S[i] = W[i] + Q[i];
+        }
+    }
+
+    if(rank == 0)
+    {
+        if(converged)
+            printf("Block CG with %zu right-hand sides converged in %zu iterations, largest relative error is %e\n", k, num_iters, max_error);
+        else if(breakdown)
+            printf("Block CG with %zu right-hand sides broke down after %zu iterations, largest relative error is %e\n", k, num_iters, max_error);
+        else
+            printf("Block CG with %zu right-hand sides did not converge in %zu iterations, largest relative error is %e\n", k, max_iters, max_error);
+    }
+
+    delete[] W;
+    delete[] S;
+    delete[] S_global;
+    delete[] Q;
+    delete[] sigma;
+    delete[] zeta;
+    delete[] M;
+    delete[] xi;
+    delete[] step;
+    delete[] tmp;
+    delete[] bb;
+    delete[] rows_per_processes;
+    delete[] row_offsets;
+
+    return converged;
+}
+
+// Independent conjugate gradient solves for the k columns of `B`, run as one batch. Each system keeps its
+// own coefficients and convergence test in the single reduction form of single_reduction_conjugate_gradients,
+// but the matrix-vector products of all the active systems are done in one pass over the matrix with gemmP
+// and all their inner products are combined into one MPI_Allreduce per iteration. Converged systems leave
+// the batch, so the remaining ones continue with narrower products.
+// `B` and `X` are local_size x k row-major blocks, the other parameters are the same as for conjugate_gradients.
+// Returns true if all the systems converged.
+bool batched_conjugate_gradients(const double * A, const double * B, double * X, size_t local_size, size_t total_rows, size_t k, size_t max_iters, double rel_error)
+{
+    int rank, mpi_size; // MPI process rank and total number of processes
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    size_t num_iters; // Counter for the number of iterations
+    size_t num_active = k; // Number of systems that did not converge yet
+    double * R = new double[local_size * k]; // Local residuals, row-major like B
+    double * P = new double[local_size * k]; // Local search directions
+    double * S = new double[local_size * k]; // Local parts of A*P
+    double * R_active = new double[local_size * k]; // Residuals of the active systems, packed
+    double * R_global = new double[total_rows * k]; // Packed residuals gathered from all processes
+    double * W_active = new double[local_size * k]; // Local parts of A*R for the active systems, packed
+    double * local_dots = new double[2 * k]; // Local parts of r*r and w*r of the active systems
+    double * global_dots = new double[2 * k];
+    double * alpha = new double[k];
+    double * beta = new double[k];
+    double * gamma = new double[k]; // r*r of every system
+    double * bb = new double[k]; // b*b of every system
+    size_t * active = new size_t[k]; // Column indices of the active systems
+    size_t * iterations = new size_t[k]; // Iteration in which every system converged
+
+    int * counts = new int[mpi_size]; // Number of packed entries handled by each process
+    int * offsets = new int[mpi_size]; // Starting offset of the packed entries for each process
+    int * rows_per_processes = new int[mpi_size]; // Number of rows handled by each process
+    int * row_offsets = new int[mpi_size]; // Starting offset of rows for each process
+    compute_row_distribution(total_rows, mpi_size, rows_per_processes, row_offsets);
+
+    // Initialize X to zero, R to B and the search directions and their products with A to zero
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < local_size * k; i++)
+    {
+        X[i] = 0.0;
+        R[i] = B[i];
+        P[i] = S[i] = 0.0;
+    }
+    for(size_t j = 0; j < k; j++)
+    {
+        active[j] = j;
+        iterations[j] = 0;
+        beta[j] = 0.0;
+    }
+
+    for(num_iters = 0; num_active > 0; num_iters++)
+    {
+        // W = A*R for all the active systems with one gather and one pass over the matrix
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            for(size_t a = 0; a < num_active; a++)
+            {
+                R_active[i * num_active + a] = R[i * k + active[a]];
+            }
+        }
+        for(int i = 0; i < mpi_size; i++)
+        {
+            counts[i] = rows_per_processes[i] * num_active;
+            offsets[i] = row_offsets[i] * num_active;
+        }
+        MPI_Allgatherv(R_active, local_size * num_active, MPI_DOUBLE, R_global, counts, offsets, MPI_DOUBLE, MPI_COMM_WORLD);
+        gemmP(A, R_global, W_active, local_size, total_rows, num_active);
+
+        // r*r and w*r of all the active systems with one reduction
+        for(size_t a = 0; a < 2 * num_active; a++)
+        {
+            local_dots[a] = 0.0;
+        }
+        #pragma omp parallel for schedule(static) reduction(+:local_dots[:2 * num_active])
+        for(size_t i = 0; i < local_size; i++)
+        {
+            for(size_t a = 0; a < num_active; a++)
+            {
+                double r_val = R_active[i * num_active + a];
+                local_dots[2 * a] += r_val * r_val;
+                local_dots[2 * a + 1] += W_active[i * num_active + a] * r_val;
+            }
+        }
+        MPI_Allreduce(local_dots, global_dots, 2 * num_active, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+        // Coefficients and convergence test of every active system, converged ones leave the batch
+        size_t width = num_active; // Row stride of the packed W columns
+        size_t num_remaining = 0;
+        for(size_t a = 0; a < num_active; a++)
+        {
+            size_t j = active[a];
+            double gamma_new = global_dots[2 * a];
+            double delta = global_dots[2 * a + 1];
+
+            if(num_iters == 0)
+            {
+                bb[j] = gamma_new;
+                alpha[j] = gamma_new / delta;
+            }
+            else
+            {
+                if(std::sqrt(gamma_new / bb[j]) < rel_error)
+                {
+                    gamma[j] = gamma_new;
+                    iterations[j] = num_iters;
+                    continue;
+                }
+                beta[j] = gamma_new / gamma[j];
+                alpha[j] = gamma_new / (delta - beta[j] * gamma_new / alpha[j]);
+            }
+            gamma[j] = gamma_new;
+
+            // Keep the packed W column of the system next to its new position in the batch
+            if(num_remaining != a)
+            {
+                #pragma omp parallel for schedule(static)
+                for(size_t i = 0; i < local_size; i++)
+                {
+                    W_active[i * width + num_remaining] = W_active[i * width + a];
+                }
+            }
+            active[num_remaining++] = j;
+        }
+        num_active = num_remaining;
+
+        if(num_iters == max_iters)
+            break;
+
+        // Update the search directions, their products with A, the solutions and the residuals
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            for(size_t a = 0; a < num_active; a++)
+            {
+                size_t j = active[a];
+                size_t idx = i * k + j;
+                P[idx] = R[idx] + beta[j] * P[idx];
+                S[idx] = W_active[i * width + a] + beta[j] * S[idx];
+                X[idx] += alpha[j] * P[idx];
+                R[idx] -= alpha[j] * S[idx];
+            }
+        }
+    }
+
+    if(rank == 0)
+    {
+        size_t min_iters = max_iters, max_converged_iters = 0;
+        double max_error = 0.0;
+        for(size_t j = 0; j < k; j++)
+        {
+            max_error = std::fmax(max_error, std::sqrt(gamma[j] / bb[j]));
+            if(iterations[j] > 0)
+            {
+                min_iters = std::min(min_iters, iterations[j]);
+                max_converged_iters = std::max(max_converged_iters, iterations[j]);
+            }
+        }
+        if(num_active == 0)
+            printf("All %zu systems converged in %zu to %zu iterations, largest relative error is %e\n", k, min_iters, max_converged_iters, max_error);
+        else
+            printf("%zu of %zu systems did not converge in %zu iterations, largest relative error is %e\n", num_active, k, max_iters, max_error);
+    }
+
+    delete[] R;
+    delete[] P;
+    delete[] S;
+    delete[] R_active;
+    delete[] R_global;
+    delete[] W_active;
+    delete[] local_dots;
+    delete[] global_dots;
+    delete[] alpha;
+    delete[] beta;
+    delete[] gamma;
+    delete[] bb;
+    delete[] active;
+    delete[] iterations;
+    delete[] counts;
+    delete[] offsets;
+    delete[] rows_per_processes;
+    delete[] row_offsets;
+
+    return num_active == 0;
+}
+
+// Kinds of preconditioners for preconditioned_conjugate_gradients
+enum preconditioner_kind
+{
+    PRECONDITIONER_JACOBI, // Inverse of the diagonal of A
+    PRECONDITIONER_BLOCK_JACOBI, // Inverse of the diagonal block of A owned by the process
+    PRECONDITIONER_CHEBYSHEV, // Chebyshev polynomial in A approximating its inverse
+    PRECONDITIONER_NYSTROM // Inverse of a randomized low-rank Nystrom approximation of A plus a shift
+};
+
+// Preconditioner for the local rows of the process, created by setup_preconditioner or
+// setup_chebyshev_preconditioner
+struct preconditioner
+{
+    preconditioner_kind kind;
+    size_t local_size;
+    double * inverse_diagonal; // Jacobi, local_size values
+    double * inverse_block; // Block Jacobi, local_size x local_size row-major
+    const double * A; // Chebyshev, local rows of the matrix
+    size_t total_rows;
+    size_t degree; // Chebyshev, degree of the polynomial
+    double eig_min, eig_max; // Chebyshev, interval on which the polynomial approximates 1/x
+    int * rows_per_processes; // Chebyshev, row distribution for gathering the directions
+    int * row_offsets;
+    double * direction; // Chebyshev work vectors, local and gathered direction and local residual
+    double * direction_global;
+    double * residual;
+    size_t num_basis_vectors; // Nystrom, number of approximate eigenvectors kept
+    double * basis; // Nystrom, local rows of the approximate eigenvectors, local_size x num_basis_vectors row-major
+    double * basis_scale; // Nystrom, eig_ref / eigenvalue - 1 for every basis vector
+    double * basis_products; // Nystrom, work vector for the products of the basis with the residual
+};
+
+// Builds the preconditioner for the local rows of `A`, `row_offset` is the global index of the first local row.
+// Called by all processes together, a block Jacobi preconditioner may fall back to Jacobi on some of them.
+preconditioner * setup_preconditioner(preconditioner_kind kind, const double * A, size_t local_size, size_t total_rows, size_t row_offset)
+{
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    preconditioner * prec = new preconditioner;
+    prec->kind = kind;
+    prec->local_size = local_size;
+    prec->inverse_diagonal = nullptr;
+    prec->inverse_block = nullptr;
+    prec->rows_per_processes = nullptr;
+    prec->row_offsets = nullptr;
+    prec->direction = nullptr;
+    prec->direction_global = nullptr;
+    prec->residual = nullptr;
+    prec->num_basis_vectors = 0;
+    prec->basis = nullptr;
+    prec->basis_scale = nullptr;
+    prec->basis_products = nullptr;
+
+    if(kind == PRECONDITIONER_BLOCK_JACOBI)
+    {
+        // Cholesky factor of the diagonal block, the block of an SPD matrix is SPD too
+        double * L = new double[local_size * local_size];
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            for(size_t j = 0; j < local_size; j++)
+            {
+                L[i * local_size + j] = A[i * total_rows + row_offset + j];
+            }
+        }
+
+        // A block that is not positive definite, which rounding or a matrix that is not SPD can produce,
+        // would give a broken factor. Such a process uses the Jacobi diagonal of its rows instead, the
+        // preconditioner stays symmetric and local.
+        bool factorized = cholesky_factorization(L, local_size);
+        int failed_local = factorized ? 0 : 1, num_failed;
+        MPI_Allreduce(&failed_local, &num_failed, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+        if(rank == 0 && num_failed > 0)
+            fprintf(stderr, "The diagonal blocks of %d processes are not positive definite, they fall back to Jacobi\n", num_failed);
+
+        // The explicit inverse turns every application into a parallel matrix-vector product instead
+        // of two sequential triangular solves. It is symmetric, so its columns are stored as rows.
+        if(factorized)
+        {
+            prec->inverse_block = new double[local_size * local_size];
+            #pragma omp parallel for schedule(dynamic, 8)
+            for(size_t c = 0; c < local_size; c++)
+            {
+                double * column = prec->inverse_block + c * local_size;
+                for(size_t i = 0; i < local_size; i++)
+                {
+                    column[i] = (i == c) ? 1.0 : 0.0;
+                }
+                cholesky_solve(L, column, local_size, 1);
+            }
+        }
+        else
+            prec->kind = PRECONDITIONER_JACOBI;
+        delete[] L;
+    }
+
+    if(prec->kind == PRECONDITIONER_JACOBI)
+    {
+        prec->inverse_diagonal = new double[local_size];
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            prec->inverse_diagonal[i] = 1.0 / A[i * total_rows + row_offset + i];
+        }
+    }
+
+    return prec;
+}
+
+// Builds a Chebyshev polynomial preconditioner of degree `degree` for a matrix with spectrum in
+// [eig_min, eig_max]. Applying it costs `degree` matrix-vector products and their gathers, but no reductions.
+preconditioner * setup_chebyshev_preconditioner(const double * A, size_t local_size, size_t total_rows, size_t degree, double eig_min, double eig_max)
+{
+    int mpi_size;
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    preconditioner * prec = new preconditioner;
+    prec->kind = PRECONDITIONER_CHEBYSHEV;
+    prec->local_size = local_size;
+    prec->inverse_diagonal = nullptr;
+    prec->inverse_block = nullptr;
+    prec->A = A;
+    prec->total_rows = total_rows;
+    prec->degree = degree;
+    prec->eig_min = eig_min;
+    prec->eig_max = eig_max;
+    prec->rows_per_processes = new int[mpi_size];
+    prec->row_offsets = new int[mpi_size];
+    compute_row_distribution(total_rows, mpi_size, prec->rows_per_processes, prec->row_offsets);
+    prec->direction = new double[local_size];
+    prec->direction_global = new double[total_rows];
+    prec->residual = new double[local_size];
+    prec->num_basis_vectors = 0;
+    prec->basis = nullptr;
+    prec->basis_scale = nullptr;
+    prec->basis_products = nullptr;
+
+    return prec;
+}
+
+// Eigendecomposition of the symmetric k x k row-major matrix M by cyclic Jacobi rotations. On exit the
+// diagonal of M holds the eigenvalues and the columns of V the corresponding orthonormal eigenvectors.
+void symmetric_eigendecomposition(double * M, double * V, size_t k)
+{
+    for(size_t i = 0; i < k * k; i++)
+    {
+        V[i] = (i % (k + 1) == 0) ? 1.0 : 0.0;
+    }
+
+    for(int sweep = 0; sweep < 50; sweep++)
+    {
+        double off = 0.0, norm = 0.0;
+        for(size_t i = 0; i < k; i++)
+        {
+            for(size_t j = 0; j < k; j++)
+            {
+                norm += M[i * k + j] * M[i * k + j];
+                if(i != j)
+                    off += M[i * k + j] * M[i * k + j];
+            }
+        }
+        if(off <= 1e-30 * norm)
+            break;
+
+        for(size_t p = 0; p < k; p++)
+        {
+            for(size_t q = p + 1; q < k; q++)
+            {
+                double m_pq = M[p * k + q];
+                if(m_pq == 0.0)
+                    continue;
+
+                // Rotation in the (p, q) plane that zeroes M[p][q]
+                double theta = (M[q * k + q] - M[p * k + p]) / (2.0 * m_pq);
+                double t = ((theta >= 0.0) ? 1.0 : -1.0) / (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+                double c = 1.0 / std::sqrt(t * t + 1.0);
+                double s = t * c;
+
+                for(size_t r = 0; r < k; r++)
+                {
+                    double m_rp = M[r * k + p], m_rq = M[r * k + q];
+                    M[r * k + p] = c * m_rp - s * m_rq;
+                    M[r * k + q] = s * m_rp + c * m_rq;
+                }
+                for(size_t r = 0; r < k; r++)
+                {
+                    double m_pr = M[p * k + r], m_qr = M[q * k + r];
+                    M[p * k + r] = c * m_pr - s * m_qr;
+                    M[q * k + r] = s * m_pr + c * m_qr;
+                }
+                for(size_t r = 0; r < k; r++)
+                {
+                    double v_rp = V[r * k + p], v_rq = V[r * k + q];
+                    V[r * k + p] = c * v_rp - s * v_rq;
+                    V[r * k + q] = s * v_rp + c * v_rq;
+                }
+            }
+        }
+    }
+}
+
+// Builds the randomized Nystrom preconditioner of rank `sketch_size` (Frangella, Tropp and Udell). The
+// sketch Y = A*Omega of a random orthonormal test matrix Omega is one pass over the local rows with gemmP,
+// and the approximation A ~ U*Lambda*U^T follows from k x k problems. The preconditioner
+// M^-1 = eig_ref*U*Lambda^-1*U^T + (I - U*U^T), with eig_ref the smallest kept eigenvalue, maps the top
+// of the spectrum onto eig_ref. Applying it needs one reduction of the products U^T*r.
+preconditioner * setup_nystrom_preconditioner(const double * A, size_t local_size, size_t total_rows, size_t sketch_size)
+{
+    int rank, mpi_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    size_t k = std::min(sketch_size, total_rows);
+    preconditioner * prec = new preconditioner;
+    prec->kind = PRECONDITIONER_NYSTROM;
+    prec->local_size = local_size;
+    prec->inverse_diagonal = nullptr;
+    prec->inverse_block = nullptr;
+    prec->rows_per_processes = nullptr;
+    prec->row_offsets = nullptr;
+    prec->direction = nullptr;
+    prec->direction_global = nullptr;
+    prec->residual = nullptr;
+    prec->num_basis_vectors = 0;
+    prec->basis = nullptr;
+    prec->basis_scale = nullptr;
+    prec->basis_products = nullptr;
+
+    double * Omega = new double[total_rows * k]; // Test matrix, the same on every process
+    double * Y = new double[local_size * k]; // Local rows of the sketch
+    double * G = new double[k * k];
+    double * V = new double[k * k];
+    double * factor = new double[k * k];
+    int * counts = new int[mpi_size];
+    int * offsets = new int[mpi_size];
+    compute_row_distribution(total_rows, mpi_size, counts, offsets);
+    double * Omega_local = Omega + (size_t)offsets[rank] * k;
+
+    // Random test matrix with the same seed on all processes, orthonormalized by the owners of its rows
+    srand(1234);
+    for(size_t i = 0; i < total_rows * k; i++)
+    {
+        Omega[i] = ((2.0 * rand()) / RAND_MAX) - 1.0;
+    }
+    bool success = cholesky_qr(Omega_local, factor, local_size, k);
+    for(int i = 0; i < mpi_size; i++)
+    {
+        counts[i] *= k;
+        offsets[i] *= k;
+    }
+    MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, Omega, counts, offsets, MPI_DOUBLE, MPI_COMM_WORLD);
+
+    // Sketch Y = A*Omega, then shift it by nu*Omega for a stable Cholesky factorization of Omega^T*Y
+    gemmP(A, Omega, Y, local_size, total_rows, k);
+    double yy_local = 0.0, yy;
+    #pragma omp parallel for schedule(static) reduction(+:yy_local)
+    for(size_t i = 0; i < local_size * k; i++)
+    {
+        yy_local += Y[i] * Y[i];
+    }
+    MPI_Allreduce(&yy_local, &yy, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    double nu = std::sqrt((double)total_rows) * 2.2e-16 * std::sqrt(yy);
+    axpbyP(nu, Omega_local, 1.0, Y, local_size * k);
+
+    // B = Y*L^-T with Omega^T*Y = L*L^T, then A + nu*I ~ B*B^T
+    block_dotP(Omega_local, Y, G, local_size, k);
+    success = success && cholesky_factorization(G, k);
+    if(success)
+    {
+        #pragma omp parallel for schedule(static)
+        for(size_t r = 0; r < local_size; r++)
+        {
+            double * y_row = Y + r * k;
+            for(size_t j = 0; j < k; j++)
+            {
+                double val = y_row[j];
+                for(size_t l = 0; l < j; l++)
+                {
+                    val -= G[j * k + l] * y_row[l];
+                }
+                y_row[j] = val / G[j * k + j];
+            }
+        }
+
+        // B = U*Sigma*V^T from the eigendecomposition of B^T*B = V*Sigma^2*V^T, eigenvalues Sigma^2 - nu
+        block_dotP(Y, Y, G, local_size, k);
+        symmetric_eigendecomposition(G, V, k);
+
+        // Keep the positive eigenvalues in decreasing order, columns of V are scaled by 1/sigma for U = B*V*Sigma^-1
+        size_t * order = new size_t[k];
+        for(size_t j = 0; j < k; j++)
+        {
+            order[j] = j;
+        }
+        std::sort(order, order + k, [&](size_t a, size_t b) { return G[a * k + a] > G[b * k + b]; });
+        size_t num_kept = 0;
+        while(num_kept < k && G[order[num_kept] * k + order[num_kept]] - nu > 0.0)
+        {
+            num_kept++;
+        }
+
+        prec->num_basis_vectors = num_kept;
+        prec->basis = new double[local_size * num_kept];
+        prec->basis_scale = new double[num_kept];
+        prec->basis_products = new double[num_kept];
+        double * V_kept = factor; // k x num_kept row-major
+        double eig_ref = (num_kept > 0) ? G[order[num_kept - 1] * k + order[num_kept - 1]] - nu : 0.0;
+        for(size_t j = 0; j < num_kept; j++)
+        {
+            double sigma_squared = G[order[j] * k + order[j]];
+            prec->basis_scale[j] = eig_ref / (sigma_squared - nu) - 1.0;
+            for(size_t i = 0; i < k; i++)
+            {
+                V_kept[i * num_kept + j] = V[i * k + order[j]] / std::sqrt(sigma_squared);
+            }
+        }
+        gemmP(Y, V_kept, prec->basis, local_size, k, num_kept);
+
+        if(rank == 0)
+            printf("Nystrom preconditioner of rank %zu, eigenvalue estimates from %e down to %e\n", num_kept, (num_kept > 0) ? G[order[0] * k + order[0]] - nu : 0.0, eig_ref);
+        delete[] order;
+    }
+    else if(rank == 0)
+    {
+        fprintf(stderr, "The Nystrom sketch is numerically rank deficient, continuing without preconditioner\n");
+    }
+
+    delete[] Omega;
+    delete[] Y;
+    delete[] G;
+    delete[] V;
+    delete[] factor;
+    delete[] counts;
+    delete[] offsets;
+
+    return prec;
+}
+
+// z = M^-1 * r for the local rows
+void apply_preconditioner(const preconditioner * prec, const double * r, double * z)
+{
+    size_t local_size = prec->local_size;
+    if(prec->kind == PRECONDITIONER_JACOBI)
+    {
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            z[i] = prec->inverse_diagonal[i] * r[i];
+        }
+    }
+    else if(prec->kind == PRECONDITIONER_BLOCK_JACOBI)
+    {
+        gemvP(1.0, prec->inverse_block, r, 0.0, z, local_size, local_size);
+    }
+    else if(prec->kind == PRECONDITIONER_CHEBYSHEV)
+    {
+        // degree + 1 steps of the Chebyshev iteration for A*z = r starting from z = 0, z is a polynomial of degree `degree` in A times r
+        double theta = 0.5 * (prec->eig_max + prec->eig_min);
+        double delta = 0.5 * (prec->eig_max - prec->eig_min);
+        double sigma = theta / delta;
+        double rho = 1.0 / sigma;
+        double * d = prec->direction;
+        double * res = prec->residual;
+
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            res[i] = r[i];
+            d[i] = r[i] / theta;
+            z[i] = 0.0;
+        }
+
+        for(size_t k = 1; ; k++)
+        {
+            axpbyP(1.0, d, 1.0, z, local_size);
+            if(k > prec->degree)
+                break;
+
+            // res = res - A*d
+            MPI_Allgatherv(d, local_size, MPI_DOUBLE, prec->direction_global, prec->rows_per_processes, prec->row_offsets, MPI_DOUBLE, MPI_COMM_WORLD);
+            gemvP(-1.0, prec->A, prec->direction_global, 1.0, res, local_size, prec->total_rows);
+
+            double rho_new = 1.0 / (2.0 * sigma - rho);
+            axpbyP(2.0 * rho_new / delta, res, rho_new * rho, d, local_size);
+            rho = rho_new;
+        }
+    }
+    else if(prec->kind == PRECONDITIONER_NYSTROM)
+    {
+        // z = r + U*diag(basis_scale)*U^T*r
+        size_t k = prec->num_basis_vectors;
+        double * products = prec->basis_products;
+        for(size_t j = 0; j < k; j++)
+        {
+            products[j] = 0.0;
+        }
+        #pragma omp parallel for schedule(static) reduction(+:products[:k])
+        for(size_t i = 0; i < local_size; i++)
+        {
+            for(size_t j = 0; j < k; j++)
+            {
+                products[j] += prec->basis[i * k + j] * r[i];
+            }
+        }
+        MPI_Allreduce(MPI_IN_PLACE, products, k, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        for(size_t j = 0; j < k; j++)
+        {
+            products[j] *= prec->basis_scale[j];
+        }
+
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            double val = r[i];
+            for(size_t j = 0; j < k; j++)
+            {
+                val += prec->basis[i * k + j] * products[j];
+            }
+            z[i] = val;
+        }
+    }
+}
+
+void free_preconditioner(preconditioner * prec)
+{
+    delete[] prec->inverse_diagonal;
+    delete[] prec->inverse_block;
+    delete[] prec->rows_per_processes;
+    delete[] prec->row_offsets;
+    delete[] prec->direction;
+    delete[] prec->direction_global;
+    delete[] prec->residual;
+    delete[] prec->basis;
+    delete[] prec->basis_scale;
+    delete[] prec->basis_products;
+    delete prec;
+}
+
+// Preconditioned conjugate gradients. The new residual norm r*r and r*z are reduced together, so an
+// iteration has two reductions like plain CG, plus the one of the Nystrom preconditioner if it is used.
+// Convergence is measured on the unpreconditioned residual. The Chebyshev preconditioner of degree
+// `chebyshev_degree` is switched on after `num_lanczos` unpreconditioned iterations, whose
+// coefficients give Lanczos estimates of the spectrum; the search direction restarts at that point.
+// The Nystrom preconditioner is built from a sketch with `nystrom_rank` columns.
+// The other parameters and the return value are the same as for conjugate_gradients.
+bool preconditioned_conjugate_gradients(const double * A, const double * b, double * x, size_t local_size, size_t total_rows, size_t max_iters, double rel_error, preconditioner_kind kind, size_t chebyshev_degree = 3, size_t num_lanczos = 20, size_t nystrom_rank = 50, bool compare_unpreconditioned = false)
+{
+    int rank, mpi_size; // MPI process rank and total number of processes
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    size_t num_iters; // Counter for the number of iterations
+    double alpha, beta, rr, rz, rz_new, bb; // Scalars for algorithm steps
+    double local_dots[2], global_dots[2]; // Local and reduced values of r*r and r*z
+    double * p = new double[total_rows]; // Global search direction vector
+    double * p_local = new double[local_size]; // Local search direction vector
+    double * Ap_local = new double[local_size]; // Local matrix-vector product result
+    double * r = new double[local_size]; // Local residual vector
+    double * z = new double[local_size]; // Local preconditioned residual
+    double * lanczos_alpha = new double[num_lanczos]; // CG coefficients of the unpreconditioned iterations
+    double * lanczos_beta = new double[num_lanczos];
+
+    int * rows_per_processes = new int[mpi_size]; // Number of rows handled by each process
+    int * row_offsets = new int[mpi_size]; // Starting offset of rows for each process
+    compute_row_distribution(total_rows, mpi_size, rows_per_processes, row_offsets);
+
+    // The Chebyshev preconditioner is built once the spectrum has been estimated, until then M = I
+    double setup_start = MPI_Wtime();
+    preconditioner * prec = nullptr;
+    if(kind == PRECONDITIONER_NYSTROM)
+        prec = setup_nystrom_preconditioner(A, local_size, total_rows, nystrom_rank);
+    else if(kind != PRECONDITIONER_CHEBYSHEV)
+        prec = setup_preconditioner(kind, A, local_size, total_rows, row_offsets[rank]);
+    double setup_time = MPI_Wtime() - setup_start;
+
+    double iterations_start = MPI_Wtime();
+
+    // Initialize x to zero, r to b and p to M^-1*b
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < local_size; i++)
+    {
+        x[i] = 0.0;
+        r[i] = b[i];
+        p_local[i] = b[i];
+    }
+    if(prec != nullptr)
+        apply_preconditioner(prec, r, p_local);
+
+    double bb_local = 0.0, rz_local = 0.0;
+    #pragma omp parallel for schedule(static) reduction(+:bb_local, rz_local)
+    for(size_t i = 0; i < local_size; i++)
+    {
+        bb_local += b[i] * b[i];
+        rz_local += b[i] * p_local[i];
+    }
+    local_dots[0] = bb_local;
+    local_dots[1] = rz_local;
+    MPI_Allreduce(local_dots, global_dots, 2, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    bb = rr = global_dots[0];
+    rz = global_dots[1];
+
+    MPI_Allgatherv(p_local, local_size, MPI_DOUBLE, p, rows_per_processes, row_offsets, MPI_DOUBLE, MPI_COMM_WORLD);
+
+    // Main iteration loop
+    for(num_iters = 1; num_iters <= max_iters; num_iters++)
+    {
+        gemvP(1.0, A, p, 0.0, Ap_local, local_size, total_rows);
+
+        alpha = rz / dotP(p_local, Ap_local, local_size);
+
+        axpbyP(alpha, p_local, 1.0, x, local_size);
+        axpbyP(-alpha, Ap_local, 1.0, r, local_size);
+
+        // Precondition the new residual, then reduce r*r and r*z together
+        if(prec != nullptr)
+            apply_preconditioner(prec, r, z);
+        else
+            memcpy(z, r, local_size * sizeof(double));
+        double rr_local = 0.0;
+        rz_local = 0.0;
+        #pragma omp parallel for schedule(static) reduction(+:rr_local, rz_local)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            rr_local += r[i] * r[i];
+            rz_local += r[i] * z[i];
+        }
+        local_dots[0] = rr_local;
+        local_dots[1] = rz_local;
+        MPI_Allreduce(local_dots, global_dots, 2, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        rr = global_dots[0];
+        rz_new = global_dots[1];
+
+        // Check for convergence
+        if(std::sqrt(rr / bb) < rel_error)
+            break;
+
+        beta = rz_new / rz;
+        rz = rz_new;
+
+        if(prec == nullptr && kind == PRECONDITIONER_CHEBYSHEV)
+        {
+            lanczos_alpha[num_iters - 1] = alpha;
+            lanczos_beta[num_iters - 1] = beta;
+            if(num_iters == num_lanczos)
+            {
+                setup_start = MPI_Wtime();
+
+                // Lanczos tridiagonal matrix of the iterations so far, its extreme eigenvalues are Ritz values of A
+                double * diag = new double[num_lanczos];
+                double * offdiag = new double[num_lanczos];
+                for(size_t j = 0; j < num_lanczos; j++)
+                {
+                    diag[j] = 1.0 / lanczos_alpha[j] + ((j > 0) ? lanczos_beta[j - 1] / lanczos_alpha[j - 1] : 0.0);
+                    offdiag[j] = std::sqrt(lanczos_beta[j]) / lanczos_alpha[j];
+                }
+                double eig_min, eig_max;
+                tridiagonal_extreme_eigenvalues(diag, offdiag, num_lanczos, &eig_min, &eig_max);
+                delete[] diag;
+                delete[] offdiag;
+
+                // The largest Ritz value converges from below, widen the interval so the polynomial stays below 1 on the spectrum
+                eig_max *= 1.1;
+                prec = setup_chebyshev_preconditioner(A, local_size, total_rows, chebyshev_degree, eig_min, eig_max);
+                if(rank == 0)
+                    printf("Chebyshev preconditioner of degree %zu on [%e, %e] after %zu Lanczos iterations\n", chebyshev_degree, eig_min, eig_max, num_lanczos);
+
+                // Restart the search direction from the preconditioned residual
+                apply_preconditioner(prec, r, z);
+                rz = dotP(r, z, local_size);
+                beta = 0.0;
+                setup_time += MPI_Wtime() - setup_start;
+            }
+        }
+
+        // Update the search direction and gather the result from all processes
+        axpbyP(1.0, z, beta, p_local, local_size);
+        MPI_Allgatherv(p_local, local_size, MPI_DOUBLE, p, rows_per_processes, row_offsets, MPI_DOUBLE, MPI_COMM_WORLD);
+    }
 
-    // Read the total number of rows and columns from the file
-    fread(&total_rows, sizeof(size_t), 1, file);
-    fread(&num_cols_local, sizeof(size_t), 1, file);
-    fseek(file, (rank * (total_rows / mpi_size) * num_cols_local) * sizeof(double), SEEK_CUR);
+    double iterations_time = MPI_Wtime() - iterations_start;
 
-    // Calculate the number of rows this process handles
-    num_rows_local = total_rows / mpi_size;
-    if(rank == mpi_size - 1) { num_rows_local += total_rows % mpi_size; }
-    
-    matrix = new double[num_rows_local * num_cols_local];
-    
-    #pragma omp parallel for schedule(static)
-    for(size_t r = 0; r < num_rows_local; r++)
+    if(rank == 0)
     {
-        for(size_t c = 0; c < num_cols_local; c++)
-        {
-            matrix[r * num_cols_local + c] = 0.0;
-        }
+        if(num_iters <= max_iters)
+            printf("Converged in %zu iterations, relative error is %e\n", num_iters, std::sqrt(rr / bb));
+        else
+            printf("Did not converge in %zu iterations, relative error is %e\n", max_iters, std::sqrt(rr / bb));
     }
-    
-    // Read the appropriate number of doubles from the file based on the process rank
-    fread(matrix, sizeof(double), num_rows_local * num_cols_local, file);
 
-    *num_cols_out = num_cols_local;
-    *num_rows_out = num_rows_local;
-    *matrix_out = matrix;
+    // The iterations saved are measured by solving the system once more without the preconditioner
+    size_t plain_iters = 0;
+    bool plain_converged = false;
+    double plain_time = 0.0;
+    if(compare_unpreconditioned)
+    {
+        if(rank == 0)
+            printf("Unpreconditioned reference solve: ");
+        double * x_plain = new double[local_size];
+        linear_operator<double> * op = setup_dense_operator(A, local_size, total_rows);
+        double plain_start = MPI_Wtime();
+        plain_converged = conjugate_gradients(op, b, x_plain, max_iters, rel_error, &plain_iters);
+        plain_time = MPI_Wtime() - plain_start;
+        free_operator(op);
+        delete[] x_plain;
+    }
 
-    fclose(file);
+    // The slowest process determines all the times
+    double times_local[3] = {setup_time, iterations_time, plain_time};
+    double times_max[3];
+    MPI_Reduce(times_local, times_max, 3, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
 
-    return true;
+    if(rank == 0)
+    {
+        size_t done_iters = std::min(num_iters, max_iters);
+        printf("Preconditioner setup took %f seconds, the cost of %.1f preconditioned iterations of %f seconds each\n", times_max[0], times_max[0] * done_iters / times_max[1], times_max[1] / done_iters);
+        if(!compare_unpreconditioned)
+            printf("The iterations saved are not measured, --compare-unpreconditioned=yes solves the system without the preconditioner too\n");
+        else if(num_iters > max_iters && !plain_converged)
+            printf("Neither solve converged in %zu iterations, so the iterations saved are not known\n", max_iters);
+        else if(plain_converged)
+            printf("The preconditioner saved %lld of %zu iterations, the solve took %f seconds including the setup against %f seconds without it\n", (long long)plain_iters - (long long)done_iters, plain_iters, times_max[0] + times_max[1], times_max[2]);
+        else
+            printf("The preconditioner saved more than %lld iterations, the unpreconditioned solve did not converge in %zu iterations\n", (long long)max_iters - (long long)done_iters, max_iters);
+    }
+
+    if(prec != nullptr)
+        free_preconditioner(prec);
+    delete[] p;
+    delete[] p_local;
+    delete[] Ap_local;
+    delete[] r;
+    delete[] z;
+    delete[] lanczos_alpha;
+    delete[] lanczos_beta;
+    delete[] rows_per_processes;
+    delete[] row_offsets;
+
+    return num_iters <= max_iters;
 }
 
-void print_matrix(const double * matrix, size_t num_rows, size_t num_cols, FILE * file = stdout)
+// Recycled subspace kept between the solves of deflated_conjugate_gradients with the same matrix
+struct recycle_space
 {
-    fprintf(file, "%zu %zu\n", num_rows, num_cols);
-    for(size_t r = 0; r < num_rows; r++)
+    size_t num_vectors; // Number of columns of W
+    size_t max_vectors; // Limit on the number of columns, harvesting stops when it is reached
+    double * W; // Local rows of the recycled vectors, local_size x num_vectors row-major
+    double * AW; // Local rows of A*W
+    double * WAW; // Cholesky factor of W^T*A*W, num_vectors x num_vectors
+};
+
+// Local part of W^T*v for the local_size x m row-major block W, reduced together with `extra`
+// local values placed in front of it, so that `result` holds the `extra` sums followed by W^T*v
+void block_transposed_dotP(const double * W, const double * v, double * result, size_t local_size, size_t m, const double * extra, size_t num_extra)
+{
+    double * local_result = new double[num_extra + m];
+    for(size_t j = 0; j < num_extra; j++)
     {
-        for(size_t c = 0; c < num_cols; c++)
+        local_result[j] = extra[j];
+    }
+    for(size_t j = 0; j < m; j++)
+    {
+        local_result[num_extra + j] = 0.0;
+    }
+    double * local_products = local_result + num_extra;
+    if(m > 0)
+    {
+        #pragma omp parallel for schedule(static) reduction(+:local_products[:m])
+        for(size_t i = 0; i < local_size; i++)
         {
-            double val = matrix[r * num_cols + c];
-            printf("%+6.3f ", val);
+            for(size_t j = 0; j < m; j++)
+            {
+                local_products[j] += W[i * m + j] * v[i];
+            }
         }
-        printf("\n");
-    }
-}
-
-double dotP(const double * x, const double * y, size_t size) {
-    // Initialize the result and the variable to hold the sub-products
-    double result = 0.0;
-    double sub_prod = 0.0;
-
-    // Parallelize the computation of the dot product
-    #pragma omp parallel for shared(x, y) schedule(static) reduction(+:sub_prod) 
-    for(size_t i = 0; i < size; i++) {
-        // Accumulate the product of corresponding elements
-        sub_prod += x[i] * y[i];
     }
-    
-    // Use MPI to reduce (sum up) all the partial dot products into 'result'
-    MPI_Allreduce(&sub_prod, &result, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
 
-    return result;
+    MPI_Allreduce(local_result, result, num_extra + m, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    delete[] local_result;
 }
 
-
-void axpbyP(double alpha, const double * x, double beta, double * y, size_t size)
+// y = y + beta*W*c for the local_size x m row-major block W
+void block_vector_axpyP(const double * W, const double * c, double beta, double * y, size_t local_size, size_t m)
 {
-    #pragma omp parallel for shared(x, y) schedule(static) 
-    for(size_t i = 0; i < size; i++)
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < local_size; i++)
     {
-        // Perform the operation y = alpha * x + beta * y for each element
-        y[i] = alpha * x[i] + beta * y[i];
+        double val = 0.0;
+        for(size_t j = 0; j < m; j++)
+        {
+            val += W[i * m + j] * c[j];
+        }
+        y[i] += beta * val;
     }
 }
 
-void gemvP(double alpha, const double * A, const double * x, double beta, double * y, size_t num_rows, size_t num_cols)
+// Appends the local_size x num_new row-major block `W_new` to the recycled subspace, computing its
+// product with A and the new factor of W^T*A*W. The vectors are dropped if the factorization fails.
+void recycle_space_append(recycle_space * space, const double * A, const double * W_new, size_t num_new, size_t local_size, size_t total_rows)
 {
-    // Parallelize over the rows of the matrix
+    int mpi_size;
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    size_t m = space->num_vectors + num_new;
+    double * W_global = new double[total_rows * num_new]; // New vectors gathered from all processes
+    double * AW_new = new double[local_size * num_new];
+    double * W = new double[local_size * m];
+    double * AW = new double[local_size * m];
+    double * WAW = new double[m * m];
+    int * counts = new int[mpi_size];
+    int * offsets = new int[mpi_size];
+    compute_row_distribution(total_rows, mpi_size, counts, offsets);
+    for(int i = 0; i < mpi_size; i++)
+    {
+        counts[i] *= num_new;
+        offsets[i] *= num_new;
+    }
+
+    // A*W_new with one gather and one pass over the matrix
+    MPI_Allgatherv(W_new, local_size * num_new, MPI_DOUBLE, W_global, counts, offsets, MPI_DOUBLE, MPI_COMM_WORLD);
+    gemmP(A, W_global, AW_new, local_size, total_rows, num_new);
+
     #pragma omp parallel for schedule(static)
-    for(size_t r = 0; r < num_rows; r++)
+    for(size_t i = 0; i < local_size; i++)
     {
-        // Initialize the accumulator for this row
-        double y_val = 0.0;
-        #pragma omp simd reduction(+:y_val)
-        for(size_t c = 0; c < num_cols; c++)
+        for(size_t j = 0; j < space->num_vectors; j++)
         {
-            // Compute the dot product of the row of A and vector x, scaled by alpha
-            y_val += alpha * A[r * num_cols + c] * x[c];
+            W[i * m + j] = space->W[i * space->num_vectors + j];
+            AW[i * m + j] = space->AW[i * space->num_vectors + j];
         }
+        for(size_t j = 0; j < num_new; j++)
+        {
+            W[i * m + space->num_vectors + j] = W_new[i * num_new + j];
+            AW[i * m + space->num_vectors + j] = AW_new[i * num_new + j];
+        }
+    }
+    block_dotP(W, AW, WAW, local_size, m);
 
-        // Update y by adding the scaled result to the scaled original y values
-        y[r] = beta * y[r] + y_val;
+    if(cholesky_factorization(WAW, m))
+    {
+        delete[] space->W;
+        delete[] space->AW;
+        delete[] space->WAW;
+        space->W = W;
+        space->AW = AW;
+        space->WAW = WAW;
+        space->num_vectors = m;
     }
+    else
+    {
+        delete[] W;
+        delete[] AW;
+        delete[] WAW;
+    }
+
+    delete[] W_global;
+    delete[] AW_new;
+    delete[] counts;
+    delete[] offsets;
 }
 
-// `A` is the matrix, `b` is the right-hand side vector, `x` is the solution vector.
-// `local_size` is the number of rows of `A` handled by this process, `total_rows` is the total number of rows in `A`.
-void conjugate_gradients(const double * A, const double * b, double * x, size_t local_size, size_t total_rows, size_t max_iters, double rel_error)
+// Deflated conjugate gradients (Saad, Yeung, Erhel and Guyomarc'h) with the recycled subspace `space`.
+// The initial guess is the Galerkin solution in W and the search directions are kept A-orthogonal to W,
+// so the eigenvectors captured by W no longer slow down convergence. The products (A*W)^T*r are reduced
+// together with r*r, so an iteration has two reductions like plain CG. During the first `num_harvest`
+// iterations the normalized residuals are stored as Lanczos vectors; at the end, Ritz vectors of the
+// `num_recycle` smallest Ritz values of the Lanczos tridiagonal matrix are added to `space` up to its
+// limit. `num_iters_out`, if given, receives the number of iterations. The other parameters and the return
+// value are the same as for conjugate_gradients.
+bool deflated_conjugate_gradients(const double * A, const double * b, double * x, size_t local_size, size_t total_rows, size_t max_iters, double rel_error, recycle_space * space, size_t num_recycle, size_t num_harvest, size_t * num_iters_out)
 {
     int rank, mpi_size; // MPI process rank and total number of processes
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
-    MPI_File file;
-    MPI_Status status;
 
+    size_t m = space->num_vectors;
     size_t num_iters; // Counter for the number of iterations
-    double alpha, beta, rr, rr_new, bb; // Scalars for algorithm steps
-    double *tmp1 = new double; // Temporary storage for dot product results
-    double *tmp2 = new double; // Temporary storage for reduced dot product results
+    size_t num_stored = 0; // Number of Lanczos vectors stored
+    double alpha, beta, rr, bb; // Scalars for algorithm steps
     double * p = new double[total_rows]; // Global search direction vector
     double * p_local = new double[local_size]; // Local search direction vector
     double * Ap_local = new double[local_size]; // Local matrix-vector product result
-    double * Ap = new double[total_rows]; // Global matrix-vector product result
     double * r = new double[local_size]; // Local residual vector
+    double * dots = new double[1 + m]; // r*r followed by (A*W)^T*r
+    double * mu = new double[m + 1]; // Coordinates of the correction in W
+    // Normalized residuals, local_size x num_harvest row-major. The product with the Ritz vectors reads all the
+    // columns, so the ones a short solve does not fill have to be zeros: zero rows of S_new do not cancel NaNs.
+    double * lanczos_vectors = new double[local_size * num_harvest]();
+    double * lanczos_alpha = new double[num_harvest];
+    double * lanczos_beta = new double[num_harvest];
 
-    // Initialize x to zero and r and p_tmp to b locally for each process
-    #pragma omp parallel for schedule(static)
-    for(size_t i = 0; i < local_size; i++)
-    {
-        x[i] = 0.0;
-        r[i] = b[i];
-        p[i] = p_local[i] = b[i];
-        Ap_local[i] = 0.0;
-    }
-
-    // Compute the distribution of rows across processes
     int * rows_per_processes = new int[mpi_size]; // Number of rows handled by each process
     int * row_offsets = new int[mpi_size]; // Starting offset of rows for each process
+    compute_row_distribution(total_rows, mpi_size, rows_per_processes, row_offsets);
 
-    // Adjust the distribution if total_rows is not divisible evenly by mpi_size
-    #pragma omp parallel for schedule(static)
-    for(int i = 0; i < mpi_size; i++)
+    // Initial guess x = W*(W^T*A*W)^-1*W^T*b and its residual r = b - A*W*(...), together with b*b
+    double bb_local = 0.0;
+    #pragma omp parallel for schedule(static) reduction(+:bb_local)
+    for(size_t i = 0; i < local_size; i++)
     {
-        rows_per_processes[i] = total_rows / mpi_size;
+        bb_local += b[i] * b[i];
+        x[i] = 0.0;
+        r[i] = b[i];
     }
-    rows_per_processes[mpi_size - 1] += total_rows % mpi_size;
+    block_transposed_dotP(space->W, b, dots, local_size, m, &bb_local, 1);
+    bb = dots[0];
+    memcpy(mu, dots + 1, m * sizeof(double));
+    cholesky_solve(space->WAW, mu, m, 1);
+    block_vector_axpyP(space->W, mu, 1.0, x, local_size, m);
+    block_vector_axpyP(space->AW, mu, -1.0, r, local_size, m);
 
-    // Calculate row offsets based on rows_per_processes
-    row_offsets[0] = 0;
-    for (int i = 1; i < mpi_size; i++)
+    // p = r - W*(W^T*A*W)^-1*(A*W)^T*r
+    double rr_local = 0.0;
+    #pragma omp parallel for schedule(static) reduction(+:rr_local)
+    for(size_t i = 0; i < local_size; i++)
     {
-        row_offsets[i] = row_offsets[i-1] + rows_per_processes[i-1];
+        rr_local += r[i] * r[i];
     }
+    block_transposed_dotP(space->AW, r, dots, local_size, m, &rr_local, 1);
+    rr = dots[0];
+    memcpy(mu, dots + 1, m * sizeof(double));
+    cholesky_solve(space->WAW, mu, m, 1);
+    memcpy(p_local, r, local_size * sizeof(double));
+    block_vector_axpyP(space->W, mu, -1.0, p_local, local_size, m);
 
-    // Compute b*b and reduce it across all processes
-    bb = dotP(b, b, local_size);
-    rr = bb; 
-
-    // Gather initial search directions from all processes
     MPI_Allgatherv(p_local, local_size, MPI_DOUBLE, p, rows_per_processes, row_offsets, MPI_DOUBLE, MPI_COMM_WORLD);
 
     // Main iteration loop
     for(num_iters = 1; num_iters <= max_iters; num_iters++)
     {
-        gemvP(1.0, A, p, 0.0, Ap_local, local_size, total_rows);
+        // Store the residual as a Lanczos vector, the signs alternate
+        if(num_stored < num_harvest)
+        {
+            double scale = ((num_stored % 2 == 0) ? 1.0 : -1.0) / std::sqrt(rr);
+            #pragma omp parallel for schedule(static)
+            for(size_t i = 0; i < local_size; i++)
+            {
+                lanczos_vectors[i * num_harvest + num_stored] = scale * r[i];
+            }
+        }
 
-        // Compute the dot product of p and Ap and reduce the result
-        *tmp2 = dotP(p_local, Ap_local, local_size);
+        gemvP(1.0, A, p, 0.0, Ap_local, local_size, total_rows);
 
-        // Update alpha, x, and r using the results
-        alpha = rr / *tmp2;
+        alpha = rr / dotP(p_local, Ap_local, local_size);
 
         axpbyP(alpha, p_local, 1.0, x, local_size);
         axpbyP(-alpha, Ap_local, 1.0, r, local_size);
-        
-        // Compute the new residual norm and reduce the result
-        *tmp2 = dotP(r, r, local_size);
 
-        rr_new = *tmp2; // Update the residual norm
-        beta = rr_new / rr; // Update beta
-        rr = rr_new; // Prepare for next iteration
+        // r*r and (A*W)^T*r with one reduction
+        rr_local = 0.0;
+        #pragma omp parallel for schedule(static) reduction(+:rr_local)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            rr_local += r[i] * r[i];
+        }
+        block_transposed_dotP(space->AW, r, dots, local_size, m, &rr_local, 1);
+        beta = dots[0] / rr;
+        rr = dots[0];
+
+        if(num_stored < num_harvest)
+        {
+            lanczos_alpha[num_stored] = alpha;
+            lanczos_beta[num_stored] = beta;
+            num_stored++;
+        }
 
         // Check for convergence
         if(std::sqrt(rr / bb) < rel_error)
-            break; // Exit loop if converged
+            break;
 
-        // Update the search direction and gather the result from all processes
+        // p = r + beta*p - W*(W^T*A*W)^-1*(A*W)^T*r and gather the result from all processes
+        memcpy(mu, dots + 1, m * sizeof(double));
+        cholesky_solve(space->WAW, mu, m, 1);
         axpbyP(1.0, r, beta, p_local, local_size);
+        block_vector_axpyP(space->W, mu, -1.0, p_local, local_size, m);
         MPI_Allgatherv(p_local, local_size, MPI_DOUBLE, p, rows_per_processes, row_offsets, MPI_DOUBLE, MPI_COMM_WORLD);
     }
 
-    if(rank == 0)
+    // Ritz vectors of the smallest Ritz values extend the recycled subspace
+    size_t num_new = std::min(std::min(num_recycle, space->max_vectors - m), num_stored / 2);
+    if(num_new > 0)
     {
-        if(num_iters <= max_iters)
-            printf("Converged in %d iterations, relative error is %e\n", num_iters, std::sqrt(rr / bb));
-        else
-            printf("Did not converge in %d iterations, relative error is %e\n", max_iters, std::sqrt(rr / bb));
+        size_t h = num_stored;
+        double * T = new double[h * h];
+        double * S = new double[h * h];
+        double * S_new = new double[num_harvest * num_new]; // Eigenvectors of T for the new vectors, zero rows past h
+        double * W_new = new double[local_size * num_new];
+        for(size_t i = 0; i < h * h; i++)
+        {
+            T[i] = 0.0;
+        }
+        for(size_t j = 0; j < h; j++)
+        {
+            T[j * h + j] = 1.0 / lanczos_alpha[j] + ((j > 0) ? lanczos_beta[j - 1] / lanczos_alpha[j - 1] : 0.0);
+            if(j + 1 < h)
+                T[j * h + j + 1] = T[(j + 1) * h + j] = std::sqrt(lanczos_beta[j]) / lanczos_alpha[j];
+        }
+        symmetric_eigendecomposition(T, S, h);
+
+        size_t * order = new size_t[h];
+        for(size_t j = 0; j < h; j++)
+        {
+            order[j] = j;
+        }
+        std::sort(order, order + h, [&](size_t a, size_t c) { return T[a * h + a] < T[c * h + c]; });
+        for(size_t i = 0; i < num_harvest; i++)
+        {
+            for(size_t j = 0; j < num_new; j++)
+            {
+                S_new[i * num_new + j] = (i < h) ? S[i * h + order[j]] : 0.0;
+            }
+        }
+        gemmP(lanczos_vectors, S_new, W_new, local_size, num_harvest, num_new);
+        recycle_space_append(space, A, W_new, num_new, local_size, total_rows);
+
+        delete[] T;
+        delete[] S;
+        delete[] S_new;
+        delete[] W_new;
+        delete[] order;
     }
-    
-    // parallel write on file
-    if(num_iters <= max_iters)
+
+    if(num_iters_out != nullptr)
+        *num_iters_out = std::min(num_iters, max_iters);
+
+    delete[] p;
+    delete[] p_local;
+    delete[] Ap_local;
+    delete[] r;
+    delete[] dots;
+    delete[] mu;
+    delete[] lanczos_vectors;
+    delete[] lanczos_alpha;
+    delete[] lanczos_beta;
+    delete[] rows_per_processes;
+    delete[] row_offsets;
+
+    return num_iters <= max_iters;
+}
+
+// Solves the systems for the k columns of `B` one after the other with deflated_conjugate_gradients,
+// recycling the subspace harvested from the previous solves; up to `num_recycle` vectors are added by
+// every solve and at most `recycle_size` are kept. `B` and `X` are local_size x k row-major blocks, the
+// other parameters are the same as for conjugate_gradients. Returns true if all the systems converged.
+bool recycling_conjugate_gradients(const double * A, const double * B, double * X, size_t local_size, size_t total_rows, size_t k, size_t max_iters, double rel_error, size_t recycle_size, size_t num_recycle)
+{
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    bool all_converged = true;
+    double * b = new double[local_size]; // Column of B being solved
+    double * x = new double[local_size];
+    recycle_space space = {0, recycle_size, nullptr, nullptr, nullptr};
+
+    for(size_t j = 0; j < k; j++)
     {
-        MPI_File_open(MPI_COMM_WORLD, "io/sol_mpi.bin", MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file);
-        if(total_rows % mpi_size != 0)
-            MPI_File_seek(file, rank * (total_rows / mpi_size) * sizeof(double), MPI_SEEK_SET);
-        else
-            MPI_File_seek(file, rank * local_size * sizeof(double), MPI_SEEK_SET); 
-        MPI_File_write(file, x, local_size, MPI_DOUBLE, &status);
-        MPI_File_close(&file);
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            b[i] = B[i * k + j];
+        }
+
+        size_t num_recycled = space.num_vectors, num_iters;
+        bool converged = deflated_conjugate_gradients(A, b, x, local_size, total_rows, max_iters, rel_error, &space, num_recycle, 4 * num_recycle + 20, &num_iters);
+        all_converged = all_converged && converged;
+
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < local_size; i++)
+        {
+            X[i * k + j] = x[i];
+        }
+
+        if(rank == 0)
+            printf("System %zu %s in %zu iterations with %zu recycled vectors\n", j, converged ? "converged" : "did not converge", num_iters, num_recycled);
     }
 
-    delete[] r; 
-    delete[] p; 
-    delete[] Ap; 
-    delete tmp1; 
-    delete tmp2;
-    delete[] Ap_local; 
-    delete[] p_local; 
+    delete[] b;
+    delete[] x;
+    delete[] space.W;
+    delete[] space.AW;
+    delete[] space.WAW;
+
+    return all_converged;
+}
+
+// Returns the value of the command line option `--name=value` if `arg` is that option, nullptr otherwise
+const char * option_value(const char * arg, const char * name)
+{
+    size_t name_length = strlen(name);
+    if(strncmp(arg, "--", 2) != 0 || strncmp(arg + 2, name, name_length) != 0 || arg[2 + name_length] != '=')
+        return nullptr;
+    return arg + 3 + name_length;
 }
 
 int main(int argc, char ** argv)
@@ -240,15 +4970,84 @@ int main(int argc, char ** argv)
     const char * input_file_matrix = "io/matrix.bin"; 
     const char * input_file_rhs = "io/rhs.bin"; 
     const char * output_file_sol = "io/sol_mpi.bin";
+    const char * algorithm = "cg";
+    size_t s = 4; // Iterations per outer step of s-step CG
+    const char * distribution = "1d";
+    const char * storage = "dense";
+    const char * matrix_precision = "double";
+    size_t replace_interval = 100; // Iterations between true residual replacements of mixed precision CG
+    double inner_rel_error = 1e-4; // Tolerance of the single precision solves of iterative refinement
+    const char * preconditioner_name = "none";
+    const char * compare_unpreconditioned = "no"; // Solve once more without the preconditioner to measure the iterations saved
+    size_t chebyshev_degree = 3; // Degree of the Chebyshev polynomial preconditioner
+    size_t lanczos_iters = 20; // Unpreconditioned iterations that estimate the spectrum for the Chebyshev preconditioner
+    size_t nystrom_rank = 50; // Number of columns of the sketch of the Nystrom preconditioner
+    size_t recycle_size = 32; // Largest recycled subspace of the recycling algorithm
+    size_t recycle_vectors = 8; // Vectors added to the recycled subspace by every solve
+    size_t sell_chunk_height = 8; // Rows per chunk of the SELL-C-sigma storage, 8 doubles fill an AVX-512 register
+    size_t sell_sigma = 256; // Window of rows sorted by length for the SELL-C-sigma storage
+    const char * operator_name = "matrix";
+    const char * loader_name = "fread";
+    size_t nx = 1200, ny = 1000; // Grid of the matrix-free heat equation operator
+    size_t chunk_size = 64; // Megabytes read by every request of the out-of-core storage
+    checkpoint_settings checkpoint = {nullptr, 100, nullptr};
+    const char * initial_guess_file = nullptr;
+    const char * gemv_kernel_name = "auto";
+    const char * omp_region = "per-kernel";
+    const char * progress = "none";
 
-    if(argc > 1) input_file_matrix = argv[1];
-    if(argc > 2) input_file_rhs = argv[2];
-    if(argc > 3) output_file_sol = argv[3];
-    if(argc > 4) max_iters = atoi(argv[4]);
-    if(argc > 5) rel_error = atof(argv[5]);
+    // Options of the form --name=value can appear anywhere, the remaining arguments are positional
+    int num_positional = 0;
+    for(int i = 1; i < argc; i++)
+    {
+        const char * value;
+        if((value = option_value(argv[i], "algorithm")) != nullptr) algorithm = value;
+        else if((value = option_value(argv[i], "s")) != nullptr) s = atoi(value);
+        else if((value = option_value(argv[i], "distribution")) != nullptr) distribution = value;
+        else if((value = option_value(argv[i], "storage")) != nullptr) storage = value;
+        else if((value = option_value(argv[i], "matrix-precision")) != nullptr) matrix_precision = value;
+        else if((value = option_value(argv[i], "replace-interval")) != nullptr) replace_interval = atoi(value);
+        else if((value = option_value(argv[i], "inner-rel-error")) != nullptr) inner_rel_error = atof(value);
+        else if((value = option_value(argv[i], "preconditioner")) != nullptr) preconditioner_name = value;
+        else if((value = option_value(argv[i], "compare-unpreconditioned")) != nullptr) compare_unpreconditioned = value;
+        else if((value = option_value(argv[i], "chebyshev-degree")) != nullptr) chebyshev_degree = atoi(value);
+        else if((value = option_value(argv[i], "lanczos-iters")) != nullptr) lanczos_iters = atoi(value);
+        else if((value = option_value(argv[i], "nystrom-rank")) != nullptr) nystrom_rank = atoi(value);
+        else if((value = option_value(argv[i], "recycle-size")) != nullptr) recycle_size = atoi(value);
+        else if((value = option_value(argv[i], "recycle-vectors")) != nullptr) recycle_vectors = atoi(value);
+        else if((value = option_value(argv[i], "sell-chunk")) != nullptr) sell_chunk_height = atoi(value);
+        else if((value = option_value(argv[i], "sell-sigma")) != nullptr) sell_sigma = atoi(value);
+        else if((value = option_value(argv[i], "operator")) != nullptr) operator_name = value;
+        else if((value = option_value(argv[i], "loader")) != nullptr) loader_name = value;
+        else if((value = option_value(argv[i], "nx")) != nullptr) nx = atoll(value);
+        else if((value = option_value(argv[i], "ny")) != nullptr) ny = atoll(value);
+        else if((value = option_value(argv[i], "chunk-size")) != nullptr) chunk_size = atoll(value);
+        else if((value = option_value(argv[i], "checkpoint")) != nullptr) checkpoint.filename = value;
+        else if((value = option_value(argv[i], "checkpoint-interval")) != nullptr) checkpoint.interval = atoll(value);
+        else if((value = option_value(argv[i], "restart")) != nullptr) checkpoint.restart_filename = value;
+        else if((value = option_value(argv[i], "initial-guess")) != nullptr) initial_guess_file = value;
+        else if((value = option_value(argv[i], "gemv-kernel")) != nullptr) gemv_kernel_name = value;
+        else if((value = option_value(argv[i], "omp-region")) != nullptr) omp_region = value;
+        else if((value = option_value(argv[i], "progress")) != nullptr) progress = value;
+        else
+        {
+            num_positional++;
+            if(num_positional == 1) input_file_matrix = argv[i];
+            if(num_positional == 2) input_file_rhs = argv[i];
+            if(num_positional == 3) output_file_sol = argv[i];
+            if(num_positional == 4) max_iters = atoi(argv[i]);
+            if(num_positional == 5) rel_error = atof(argv[i]);
+        }
+    }
 
     if(rank == 0){
-        printf("Usage: ./random_matrix input_file_matrix.bin input_file_rhs.bin output_file_sol.bin max_iters rel_error\n");
+        printf("Usage: ./random_matrix input_file_matrix.bin input_file_rhs.bin output_file_sol.bin max_iters rel_error [--algorithm=cg|pipelined|single-reduction|s-step|refinement|block|batched|recycling] [--s=4] [--distribution=1d|2d] [--storage=dense|packed|csr|sell|out-of-core]\n");
+        printf("       [--matrix-precision=double|float|bfloat16] [--replace-interval=100] [--inner-rel-error=1e-4]\n");
+        printf("       [--preconditioner=none|jacobi|block-jacobi|chebyshev|nystrom] [--chebyshev-degree=3] [--lanczos-iters=20]\n");
+        printf("       [--nystrom-rank=50] [--compare-unpreconditioned=no|yes] [--recycle-size=32] [--recycle-vectors=8] [--sell-chunk=8] [--sell-sigma=256]\n");
+        printf("       [--operator=matrix|laplacian] [--nx=1200] [--ny=1000] [--loader=fread|mmap|mmap-willneed|mmap-populate|mpiio]\n");
+        printf("       [--chunk-size=64] [--checkpoint=file] [--checkpoint-interval=100] [--restart=file] [--initial-guess=file]\n");
+        printf("       [--gemv-kernel=auto|portable|avx2|avx512] [--omp-region=per-kernel|persistent] [--progress=none|thread]\n");
         printf("All parameters are optional and have default values\n");
         printf("\n");
 
@@ -258,9 +5057,252 @@ int main(int argc, char ** argv)
         printf("  output_file_sol:   %s\n", output_file_sol);
         printf("  max_iters:         %d\n", max_iters);
         printf("  rel_error:         %e\n", rel_error);
+        printf("  algorithm:         %s\n", algorithm);
+        if(strcmp(algorithm, "s-step") == 0)
+            printf("  s:                 %zu\n", s);
+        if(strcmp(algorithm, "refinement") == 0)
+            printf("  inner_rel_error:   %e\n", inner_rel_error);
+        if(strcmp(algorithm, "recycling") == 0)
+        {
+            printf("  recycle_size:      %zu\n", recycle_size);
+            printf("  recycle_vectors:   %zu\n", recycle_vectors);
+        }
+        printf("  distribution:      %s\n", distribution);
+        printf("  storage:           %s\n", storage);
+        if(strcmp(storage, "sell") == 0)
+        {
+            printf("  sell_chunk:        %zu\n", sell_chunk_height);
+            printf("  sell_sigma:        %zu\n", sell_sigma);
+        }
+        if(strcmp(storage, "out-of-core") == 0)
+            printf("  chunk_size:        %zu MB\n", chunk_size);
+        printf("  matrix_precision:  %s\n", matrix_precision);
+        printf("  operator:          %s\n", operator_name);
+        printf("  loader:            %s\n", loader_name);
+        printf("  omp_region:        %s\n", omp_region);
+        printf("  progress:          %s\n", progress);
+        if(strcmp(progress, "thread") == 0)
+            printf("  mpi_thread_level:  %s\n", thread_level == MPI_THREAD_MULTIPLE ? "multiple" : (thread_level == MPI_THREAD_SERIALIZED ? "serialized" : (thread_level == MPI_THREAD_FUNNELED ? "funneled" : "single")));
+        printf("  gemv_kernel:       %s\n", strcmp(gemv_kernel_name, "auto") == 0 ? gemv_isa_name(detect_gemv_isa()) : gemv_kernel_name);
+        if(strcmp(operator_name, "laplacian") == 0)
+            printf("  grid:              %zu x %zu\n", nx, ny);
+        printf("  preconditioner:    %s\n", preconditioner_name);
+        if(strcmp(preconditioner_name, "none") != 0)
+            printf("  compare_unprec:    %s\n", compare_unpreconditioned);
+        if(strcmp(preconditioner_name, "chebyshev") == 0)
+        {
+            printf("  chebyshev_degree:  %zu\n", chebyshev_degree);
+            printf("  lanczos_iters:     %zu\n", lanczos_iters);
+        }
+        if(strcmp(preconditioner_name, "nystrom") == 0)
+            printf("  nystrom_rank:      %zu\n", nystrom_rank);
+        if(strcmp(matrix_precision, "double") != 0)
+            printf("  replace_interval:  %zu\n", replace_interval);
+        if(checkpoint.filename != nullptr)
+            printf("  checkpoint:        %s every %zu iterations\n", checkpoint.filename, checkpoint.interval);
+        if(checkpoint.restart_filename != nullptr)
+            printf("  restart:           %s\n", checkpoint.restart_filename);
+        if(initial_guess_file != nullptr)
+            printf("  initial_guess:     %s\n", initial_guess_file);
         printf("\n");
     }
 
+    gemv_isa isa = detect_gemv_isa();
+    if(strcmp(gemv_kernel_name, "auto") != 0 && (!parse_gemv_isa(gemv_kernel_name, &isa) || !gemv_isa_supported(isa)))
+    {
+        if(rank == 0)
+            fprintf(stderr, "Unknown gemv kernel %s or not supported by the processor\n", gemv_kernel_name);
+        MPI_Finalize();
+        return 13;
+    }
+    gemv_rows = select_gemv_kernel(isa);
+
+    bool persistent = strcmp(omp_region, "persistent") == 0;
+    if(!persistent && strcmp(omp_region, "per-kernel") != 0)
+    {
+        if(rank == 0)
+            fprintf(stderr, "Unknown OpenMP region mode %s\n", omp_region);
+        MPI_Finalize();
+        return 14;
+    }
+
+    bool progress_thread = strcmp(progress, "thread") == 0;
+    if(!progress_thread && strcmp(progress, "none") != 0)
+    {
+        if(rank == 0)
+            fprintf(stderr, "Unknown progress mode %s\n", progress);
+        MPI_Finalize();
+        return 15;
+    }
+
+    bool mixed_precision = strcmp(matrix_precision, "double") != 0;
+    if(mixed_precision && (strcmp(matrix_precision, "float") != 0 && strcmp(matrix_precision, "bfloat16") != 0))
+    {
+        if(rank == 0)
+            fprintf(stderr, "Unknown matrix precision %s\n", matrix_precision);
+        MPI_Finalize();
+        return 9;
+    }
+    if(mixed_precision && (strcmp(algorithm, "cg") != 0 || strcmp(distribution, "1d") != 0 || strcmp(storage, "dense") != 0 || (ssize_t)replace_interval <= 0))
+    {
+        if(rank == 0)
+            fprintf(stderr, "The mixed precision matrix needs the cg algorithm, 1d distribution, dense storage and a positive replace interval\n");
+        MPI_Finalize();
+        return 9;
+    }
+
+    bool preconditioned = strcmp(preconditioner_name, "none") != 0;
+    if(preconditioned && strcmp(preconditioner_name, "jacobi") != 0 && strcmp(preconditioner_name, "block-jacobi") != 0 && strcmp(preconditioner_name, "chebyshev") != 0 && strcmp(preconditioner_name, "nystrom") != 0)
+    {
+        if(rank == 0)
+            fprintf(stderr, "Unknown preconditioner %s\n", preconditioner_name);
+        MPI_Finalize();
+        return 10;
+    }
+    if(preconditioned && (strcmp(algorithm, "cg") != 0 || strcmp(distribution, "1d") != 0 || strcmp(storage, "dense") != 0 || mixed_precision))
+    {
+        if(rank == 0)
+            fprintf(stderr, "Preconditioners need the cg algorithm, 1d distribution and dense double precision storage\n");
+        MPI_Finalize();
+        return 10;
+    }
+    if(strcmp(preconditioner_name, "chebyshev") == 0 && ((ssize_t)chebyshev_degree <= 0 || (ssize_t)lanczos_iters < 2))
+    {
+        if(rank == 0)
+            fprintf(stderr, "The Chebyshev preconditioner needs a positive degree and at least 2 Lanczos iterations\n");
+        MPI_Finalize();
+        return 10;
+    }
+    if(strcmp(preconditioner_name, "nystrom") == 0 && (ssize_t)nystrom_rank <= 0)
+    {
+        if(rank == 0)
+            fprintf(stderr, "The Nystrom rank has to be positive\n");
+        MPI_Finalize();
+        return 10;
+    }
+
+    bool checkpointed = checkpoint.filename != nullptr || checkpoint.restart_filename != nullptr;
+    if(checkpointed && (strcmp(algorithm, "cg") != 0 || strcmp(distribution, "1d") != 0 || strcmp(storage, "dense") != 0 || strcmp(operator_name, "matrix") != 0 || mixed_precision || preconditioned))
+    {
+        if(rank == 0)
+            fprintf(stderr, "Checkpoints need the cg algorithm without a preconditioner, 1d distribution and dense double precision storage\n");
+        MPI_Finalize();
+        return 11;
+    }
+    if(initial_guess_file != nullptr && (strcmp(algorithm, "cg") != 0 || strcmp(distribution, "1d") != 0 || strcmp(storage, "dense") != 0 || strcmp(operator_name, "matrix") != 0 || mixed_precision || preconditioned))
+    {
+        if(rank == 0)
+            fprintf(stderr, "An initial guess needs the cg algorithm without a preconditioner, 1d distribution and dense double precision storage\n");
+        MPI_Finalize();
+        return 12;
+    }
+    if(persistent && (strcmp(algorithm, "cg") != 0 || strcmp(distribution, "1d") != 0 || strcmp(storage, "dense") != 0 || strcmp(operator_name, "matrix") != 0 || mixed_precision || preconditioned || checkpointed || initial_guess_file != nullptr))
+    {
+        if(rank == 0)
+            fprintf(stderr, "The persistent OpenMP region needs the cg algorithm without a preconditioner, checkpoints or initial guess, 1d distribution and dense double precision storage\n");
+        MPI_Finalize();
+        return 14;
+    }
+    if(progress_thread && (strcmp(algorithm, "pipelined") != 0 || strcmp(distribution, "1d") != 0 || strcmp(storage, "dense") != 0 || strcmp(operator_name, "matrix") != 0 || mixed_precision || preconditioned || persistent))
+    {
+        if(rank == 0)
+            fprintf(stderr, "The progress thread needs the pipelined algorithm, 1d distribution, dense double precision storage and per-kernel OpenMP regions\n");
+        MPI_Finalize();
+        return 15;
+    }
+    if(checkpoint.filename != nullptr && (ssize_t)checkpoint.interval <= 0)
+    {
+        if(rank == 0)
+            fprintf(stderr, "The checkpoint interval has to be positive\n");
+        MPI_Finalize();
+        return 11;
+    }
+
+    // The matrix-free heat equation operator needs no input files
+    if(strcmp(operator_name, "matrix") != 0)
+    {
+        int exit_code;
+        if(strcmp(operator_name, "laplacian") != 0)
+        {
+            if(rank == 0)
+                fprintf(stderr, "Unknown operator %s\n", operator_name);
+            exit_code = 8;
+        }
+        else if(strcmp(algorithm, "cg") != 0 || strcmp(distribution, "1d") != 0 || strcmp(storage, "dense") != 0)
+        {
+            if(rank == 0)
+                fprintf(stderr, "The laplacian operator supports only the cg algorithm with the default distribution and storage\n");
+            exit_code = 6;
+        }
+        else
+            exit_code = solve_heat_equation(nx, ny, output_file_sol, max_iters, rel_error);
+        MPI_Finalize();
+        return exit_code;
+    }
+
+    // The 2d distribution and the packed, sparse and out-of-core storage have their own reading and solution paths
+    bool sparse = strcmp(storage, "csr") == 0 || strcmp(storage, "sell") == 0;
+    bool out_of_core = strcmp(storage, "out-of-core") == 0;
+    if(strcmp(distribution, "2d") == 0 || strcmp(storage, "packed") == 0 || sparse || out_of_core)
+    {
+        int exit_code;
+        if(strcmp(algorithm, "cg") != 0)
+        {
+            if(rank == 0)
+                fprintf(stderr, "The 2d distribution and the packed, sparse and out-of-core storage support only the cg algorithm\n");
+            exit_code = 6;
+        }
+        else if(strcmp(distribution, "2d") == 0 && strcmp(storage, "dense") != 0)
+        {
+            if(rank == 0)
+                fprintf(stderr, "The 2d distribution supports only the dense storage\n");
+            exit_code = 8;
+        }
+        else if(strcmp(storage, "sell") == 0 && ((ssize_t)sell_chunk_height <= 0 || sell_chunk_height > SELL_MAX_CHUNK_HEIGHT || (ssize_t)sell_sigma <= 0))
+        {
+            if(rank == 0)
+                fprintf(stderr, "The SELL chunk height has to be between 1 and %zu and sigma has to be positive\n", SELL_MAX_CHUNK_HEIGHT);
+            exit_code = 8;
+        }
+        else if(out_of_core && (ssize_t)chunk_size <= 0)
+        {
+            if(rank == 0)
+                fprintf(stderr, "The chunk size has to be positive\n");
+            exit_code = 8;
+        }
+        else if(strcmp(distribution, "2d") == 0)
+            exit_code = solve_with_2d_distribution(input_file_matrix, input_file_rhs, output_file_sol, max_iters, rel_error);
+        else if(strcmp(storage, "packed") == 0)
+            exit_code = solve_with_packed_storage(input_file_matrix, input_file_rhs, output_file_sol, max_iters, rel_error);
+        else if(out_of_core)
+            exit_code = solve_out_of_core(input_file_matrix, input_file_rhs, output_file_sol, max_iters, rel_error, chunk_size << 20);
+        else
+            exit_code = solve_with_csr_storage(input_file_matrix, input_file_rhs, output_file_sol, max_iters, rel_error, strcmp(storage, "sell") == 0 ? sell_chunk_height : 0, sell_sigma);
+        MPI_Finalize();
+        return exit_code;
+    }
+    if(strcmp(distribution, "1d") != 0 || strcmp(storage, "dense") != 0)
+    {
+        if(rank == 0)
+            fprintf(stderr, "Unknown distribution %s or storage %s\n", distribution, storage);
+        MPI_Finalize();
+        return 8;
+    }
+
+    matrix_loader loader;
+    if(strcmp(loader_name, "fread") == 0) loader = LOADER_FREAD;
+    else if(strcmp(loader_name, "mmap") == 0) loader = LOADER_MMAP;
+    else if(strcmp(loader_name, "mmap-willneed") == 0) loader = LOADER_MMAP_WILLNEED;
+    else if(strcmp(loader_name, "mmap-populate") == 0) loader = LOADER_MMAP_POPULATE;
+    else if(strcmp(loader_name, "mpiio") == 0) loader = LOADER_MPIIO;
+    else
+    {
+        if(rank == 0)
+            fprintf(stderr, "Unknown loader %s\n", loader_name);
+        MPI_Finalize();
+        return 8;
+    }
+
     double * matrix;
     size_t matrix_rows_local;
     size_t matrix_cols;
@@ -273,11 +5315,24 @@ int main(int argc, char ** argv)
     if(rank == 0)
         printf("Reading matrix right hand side from file\n\n");
 
-    bool success_read_matrix = read_matrix_from_file(input_file_matrix, &matrix, &matrix_rows_local, &matrix_cols); 
-    bool success_read_rhs = read_matrix_from_file(input_file_rhs, &rhs, &rhs_rows, &rhs_cols);   
+    double load_start = MPI_Wtime();
+    bool success_read_matrix = load_matrix_from_file(input_file_matrix, loader, &matrix, &matrix_rows_local, &matrix_cols);
+    bool success_read_rhs = load_matrix_from_file(input_file_rhs, loader, &rhs, &rhs_rows, &rhs_cols);
+    double load_time = MPI_Wtime() - load_start, load_time_max;
+
+    // A failed map or read may be local to one process, all processes have to agree
+    MPI_Allreduce(MPI_IN_PLACE, &success_read_matrix, 1, MPI_C_BOOL, MPI_LAND, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &success_read_rhs, 1, MPI_C_BOOL, MPI_LAND, MPI_COMM_WORLD);
+    MPI_Reduce(&load_time, &load_time_max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    // Aggregate bandwidth of all the processes, the slowest one determines the time
+    double bytes_read = 0.0, total_bytes_read;
+    if(success_read_matrix && success_read_rhs)
+        bytes_read = (double)(matrix_rows_local * matrix_cols + rhs_rows * rhs_cols) * sizeof(double);
+    MPI_Reduce(&bytes_read, &total_bytes_read, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
 
     if(rank == 0)
-        printf("Done\n\n");
+        printf("Done in %f seconds, aggregate read bandwidth %.1f MB/s\n\n", load_time_max, total_bytes_read / load_time_max / 1e6);
 
     // Controls
     if(!success_read_matrix){
@@ -293,21 +5348,79 @@ int main(int argc, char ** argv)
         fprintf(stderr, "Size of right hand side does not match the matrix\n");
         return 4;
     }
-    if(rhs_cols != 1)
+    if(rhs_cols != 1 && strcmp(algorithm, "block") != 0 && strcmp(algorithm, "batched") != 0 && strcmp(algorithm, "recycling") != 0)
     {
-        fprintf(stderr, "Right hand side has to have just a single column\n");
+        fprintf(stderr, "Right hand side has to have just a single column, use the block, batched or recycling algorithm for more\n");
         return 5;
     }
+    if(strcmp(algorithm, "cg") != 0 && strcmp(algorithm, "pipelined") != 0 && strcmp(algorithm, "single-reduction") != 0 && strcmp(algorithm, "s-step") != 0 && strcmp(algorithm, "refinement") != 0 && strcmp(algorithm, "block") != 0 && strcmp(algorithm, "batched") != 0 && strcmp(algorithm, "recycling") != 0)
+    {
+        fprintf(stderr, "Unknown algorithm %s\n", algorithm);
+        return 6;
+    }
+    if((ssize_t)s <= 0)
+    {
+        fprintf(stderr, "The s-step parameter has to be positive\n");
+        return 7;
+    }
+    if(strcmp(algorithm, "recycling") == 0 && ((ssize_t)recycle_size < 0 || (ssize_t)recycle_vectors <= 0))
+    {
+        fprintf(stderr, "The recycled subspace size cannot be negative and the vectors added per solve have to be positive\n");
+        return 7;
+    }
     
     // Solve the sistem
-    double * sol = new double[matrix_cols];
+    double * sol = new double[matrix_cols * rhs_cols];
+    if(initial_guess_file != nullptr && !read_vector_from_file(initial_guess_file, sol, matrix_rows_local, rank * (matrix_cols / mpi_size), matrix_cols))
+    {
+        fprintf(stderr, "Failed to read an initial guess of size %zu\n", matrix_cols);
+        return 12;
+    }
     double start_time = MPI_Wtime();
 
-    conjugate_gradients(matrix, rhs, sol, matrix_rows_local, matrix_cols, max_iters, rel_error);
+    bool converged;
+    bool compare = strcmp(compare_unpreconditioned, "yes") == 0;
+    if(strcmp(preconditioner_name, "jacobi") == 0)
+        converged = preconditioned_conjugate_gradients(matrix, rhs, sol, matrix_rows_local, matrix_cols, max_iters, rel_error, PRECONDITIONER_JACOBI, chebyshev_degree, lanczos_iters, nystrom_rank, compare);
+    else if(strcmp(preconditioner_name, "block-jacobi") == 0)
+        converged = preconditioned_conjugate_gradients(matrix, rhs, sol, matrix_rows_local, matrix_cols, max_iters, rel_error, PRECONDITIONER_BLOCK_JACOBI, chebyshev_degree, lanczos_iters, nystrom_rank, compare);
+    else if(strcmp(preconditioner_name, "chebyshev") == 0)
+        converged = preconditioned_conjugate_gradients(matrix, rhs, sol, matrix_rows_local, matrix_cols, max_iters, rel_error, PRECONDITIONER_CHEBYSHEV, chebyshev_degree, lanczos_iters, nystrom_rank, compare);
+    else if(strcmp(preconditioner_name, "nystrom") == 0)
+        converged = preconditioned_conjugate_gradients(matrix, rhs, sol, matrix_rows_local, matrix_cols, max_iters, rel_error, PRECONDITIONER_NYSTROM, chebyshev_degree, lanczos_iters, nystrom_rank, compare);
+    else if(strcmp(matrix_precision, "float") == 0)
+        converged = solve_mixed_precision<float>(matrix, rhs, sol, matrix_rows_local, matrix_cols, max_iters, rel_error, replace_interval);
+    else if(strcmp(matrix_precision, "bfloat16") == 0)
+        converged = solve_mixed_precision<bfloat16>(matrix, rhs, sol, matrix_rows_local, matrix_cols, max_iters, rel_error, replace_interval);
+    else if(strcmp(algorithm, "pipelined") == 0)
+        converged = pipelined_conjugate_gradients(matrix, rhs, sol, matrix_rows_local, matrix_cols, max_iters, rel_error, progress_thread);
+    else if(strcmp(algorithm, "single-reduction") == 0)
+        converged = single_reduction_conjugate_gradients(matrix, rhs, sol, matrix_rows_local, matrix_cols, max_iters, rel_error);
+    else if(strcmp(algorithm, "s-step") == 0)
+        converged = s_step_conjugate_gradients(matrix, rhs, sol, matrix_rows_local, matrix_cols, max_iters, rel_error, s);
+    else if(strcmp(algorithm, "refinement") == 0)
+        converged = iterative_refinement(matrix, rhs, sol, matrix_rows_local, matrix_cols, max_iters, rel_error, inner_rel_error);
+    else if(strcmp(algorithm, "block") == 0)
+        converged = block_conjugate_gradients(matrix, rhs, sol, matrix_rows_local, matrix_cols, rhs_cols, max_iters, rel_error);
+    else if(strcmp(algorithm, "batched") == 0)
+        converged = batched_conjugate_gradients(matrix, rhs, sol, matrix_rows_local, matrix_cols, rhs_cols, max_iters, rel_error);
+    else if(persistent)
+        converged = persistent_conjugate_gradients(matrix, rhs, sol, matrix_rows_local, matrix_cols, max_iters, rel_error);
+    else if(strcmp(algorithm, "recycling") == 0)
+        converged = recycling_conjugate_gradients(matrix, rhs, sol, matrix_rows_local, matrix_cols, rhs_cols, max_iters, rel_error, recycle_size, recycle_vectors);
+    else
+    {
+        linear_operator<double> * op = setup_dense_operator(matrix, matrix_rows_local, matrix_cols);
+        converged = conjugate_gradients(op, rhs, sol, max_iters, rel_error, nullptr, &checkpoint, initial_guess_file != nullptr);
+        free_operator(op);
+    }
 
     double end_time = MPI_Wtime();
     double elapsed_time = end_time - start_time;
 
+    if(converged)
+        write_solution_to_file(output_file_sol, sol, matrix_rows_local, rank * (matrix_cols / mpi_size), rhs_cols);
+
     if(rank == 0)
         printf("Finished successfully. Time taken to solve the sistem of size %d: %f seconds", matrix_cols, elapsed_time);
     
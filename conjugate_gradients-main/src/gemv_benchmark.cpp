@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <omp.h>
+
+#include "gemv_kernels.h"
+
+// Microbenchmark of the dense matrix-vector kernels of gemv_kernels.h. The product reads the matrix once
+// and is bound by memory bandwidth, so every kernel is compared with the bandwidth of the STREAM triad
+// over the same amount of memory. The matrix should be much larger than the caches.
+
+// The row at a time loop that gemvP used before the register-blocked kernels
+void gemv_row_at_a_time(double alpha, const double * A, const double * x, double beta, double * y, size_t num_rows, size_t num_cols, size_t row_stride)
+{
+    for(size_t r = 0; r < num_rows; r++)
+    {
+        double y_val = 0.0;
+        #pragma omp simd reduction(+:y_val)
+        for(size_t c = 0; c < num_cols; c++)
+        {
+            y_val += alpha * A[r * row_stride + c] * x[c];
+        }
+        y[r] = (beta == 0.0) ? y_val : beta * y[r] + y_val;
+    }
+}
+
+// Best time of `repetitions` parallel products with the kernel, every thread multiplies its rows of schedule(static)
+double time_gemv(gemv_kernel kernel, const double * A, const double * x, double * y, size_t num_rows, size_t num_cols, int repetitions)
+{
+    double best_time = 1e30;
+    for(int k = 0; k < repetitions; k++)
+    {
+        double start_time = omp_get_wtime();
+        #pragma omp parallel
+        {
+            size_t row_begin, row_end;
+            static_thread_rows(num_rows, omp_get_thread_num(), omp_get_num_threads(), &row_begin, &row_end);
+            kernel(1.0, A + row_begin * num_cols, x, 0.0, y + row_begin, row_end - row_begin, num_cols, num_cols);
+        }
+        best_time = std::min(best_time, omp_get_wtime() - start_time);
+    }
+    return best_time;
+}
+
+int main(int argc, char ** argv)
+{
+    size_t num_rows = 8192;
+    size_t num_cols = 8192;
+    int repetitions = 20;
+
+    if(argc > 1) num_rows = atoll(argv[1]);
+    if(argc > 2) num_cols = atoll(argv[2]);
+    if(argc > 3) repetitions = atoi(argv[3]);
+
+    printf("Usage: ./gemv_benchmark num_rows num_cols repetitions\n");
+    printf("Matrix of %zu x %zu doubles (%.1f MB), best of %d repetitions with %d threads\n\n", num_rows, num_cols, num_rows * num_cols * sizeof(double) / 1e6, repetitions, omp_get_max_threads());
+
+    // STREAM triad a = b + s*c over the same amount of memory as the matrix, counting 3 arrays as STREAM does
+    size_t n = num_rows * num_cols / 3;
+    double * a = new double[n];
+    double * b = new double[n];
+    double * c = new double[n];
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < n; i++)
+    {
+        a[i] = 0.0;
+        b[i] = 1.0;
+        c[i] = 2.0;
+    }
+    double triad_time = 1e30;
+    for(int k = 0; k < repetitions; k++)
+    {
+        double start_time = omp_get_wtime();
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < n; i++)
+        {
+            a[i] = b[i] + 3.0 * c[i];
+        }
+        triad_time = std::min(triad_time, omp_get_wtime() - start_time);
+    }
+    double stream_bandwidth = 3.0 * n * sizeof(double) / triad_time / 1e9;
+    printf("%-18s %10.3f ms %8.2f GB/s (check %f)\n", "stream triad", triad_time * 1e3, stream_bandwidth, a[n / 2]);
+
+    delete[] a;
+    delete[] b;
+    delete[] c;
+
+    double matrix_bytes = (double)num_rows * num_cols * sizeof(double);
+    double * A = new double[num_rows * num_cols];
+    double * x = new double[num_cols];
+    double * y = new double[num_rows];
+    double * y_ref = new double[num_rows];
+
+    // First touch with the same row partition as the products
+    #pragma omp parallel for schedule(static)
+    for(size_t r = 0; r < num_rows; r++)
+    {
+        for(size_t c = 0; c < num_cols; c++)
+        {
+            A[r * num_cols + c] = 1.0 / (1.0 + ((r * 7 + c * 13) % 101));
+        }
+    }
+    for(size_t c = 0; c < num_cols; c++)
+    {
+        x[c] = 1.0 + (c % 17) * 0.125;
+    }
+
+    // Bytes of the matrix, x and y moved by a product
+    double gemv_bytes = matrix_bytes + (double)(num_cols + num_rows) * sizeof(double);
+    double baseline_time = time_gemv(gemv_row_at_a_time, A, x, y_ref, num_rows, num_cols, repetitions);
+    printf("%-18s %10.3f ms %8.2f GB/s %6.1f%% of STREAM\n", "row-at-a-time", baseline_time * 1e3, gemv_bytes / baseline_time / 1e9, 100.0 * gemv_bytes / baseline_time / 1e9 / stream_bandwidth);
+
+    gemv_isa isas[3] = {GEMV_PORTABLE, GEMV_AVX2, GEMV_AVX512};
+    for(int i = 0; i < 3; i++)
+    {
+        if(!gemv_isa_supported(isas[i]))
+        {
+            printf("%-18s not supported by the processor\n", gemv_isa_name(isas[i]));
+            continue;
+        }
+        double time = time_gemv(select_gemv_kernel(isas[i]), A, x, y, num_rows, num_cols, repetitions);
+
+        double max_difference = 0.0;
+        for(size_t r = 0; r < num_rows; r++)
+        {
+            max_difference = std::fmax(max_difference, std::fabs(y[r] - y_ref[r]) / std::fabs(y_ref[r]));
+        }
+        printf("%-18s %10.3f ms %8.2f GB/s %6.1f%% of STREAM, %.2fx row-at-a-time, max relative difference %.1e\n", gemv_isa_name(isas[i]), time * 1e3, gemv_bytes / time / 1e9, 100.0 * gemv_bytes / time / 1e9 / stream_bandwidth, baseline_time / time, max_difference);
+    }
+
+    delete[] A;
+    delete[] x;
+    delete[] y;
+    delete[] y_ref;
+
+    return 0;
+}
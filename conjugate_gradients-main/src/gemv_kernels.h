@@ -0,0 +1,252 @@
+#ifndef GEMV_KERNELS_H
+#define GEMV_KERNELS_H
+
+// Dense matrix-vector kernels y = alpha*A*x + beta*y for a row-major block of rows, shared by
+// conjugate_gradients.cpp and gemv_benchmark.cpp. The kernels multiply several rows at once, so every
+// chunk of x loaded into registers is used for all of them, and alpha is applied once per row.
+// The SIMD kernels are compiled for their instruction set with target attributes whatever the flags
+// of the program are, and detect_gemv_isa chooses the best one the processor supports at runtime.
+
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define GEMV_X86 1
+#include <immintrin.h>
+#else
+#define GEMV_X86 0
+#endif
+
+// Instruction sets of the kernels
+enum gemv_isa
+{
+    GEMV_PORTABLE, // Plain C++ vectorized by the compiler for the flags of the program
+    GEMV_AVX2, // AVX2 with FMA, 4 rows of 8 columns per step
+    GEMV_AVX512 // AVX-512F, 8 rows of 16 columns per step
+};
+
+// Kernel for `num_rows` rows of `A` with `num_cols` columns, consecutive rows are `row_stride` doubles apart
+// so the block may be part of a wider matrix. As in BLAS y is not read when beta is zero.
+typedef void (*gemv_kernel)(double alpha, const double * A, const double * x, double beta, double * y, size_t num_rows, size_t num_cols, size_t row_stride);
+
+// Distance in doubles of the software prefetch ahead of the current column of every row. With 4 or 8
+// rows read at once there are more streams than the hardware prefetchers follow well, so every row is
+// prefetched 2 KB ahead into L1. The non-temporal hint (_MM_HINT_NTA) was measured to be slower: it
+// bypasses the L2 that the hardware prefetchers fill, and the matrix is only read, so no stores to avoid.
+const size_t GEMV_PREFETCH_DISTANCE = 256;
+
+inline void gemv_portable(double alpha, const double * A, const double * x, double beta, double * y, size_t num_rows, size_t num_cols, size_t row_stride)
+{
+    size_t r = 0;
+    for(; r + 4 <= num_rows; r += 4)
+    {
+        const double * row0 = A + r * row_stride;
+        const double * row1 = row0 + row_stride;
+        const double * row2 = row1 + row_stride;
+        const double * row3 = row2 + row_stride;
+        double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+        #pragma omp simd reduction(+:s0, s1, s2, s3)
+        for(size_t c = 0; c < num_cols; c++)
+        {
+            s0 += row0[c] * x[c];
+            s1 += row1[c] * x[c];
+            s2 += row2[c] * x[c];
+            s3 += row3[c] * x[c];
+        }
+        double sum[4] = {s0, s1, s2, s3};
+        for(int k = 0; k < 4; k++)
+        {
+            y[r + k] = (beta == 0.0) ? alpha * sum[k] : beta * y[r + k] + alpha * sum[k];
+        }
+    }
+    for(; r < num_rows; r++)
+    {
+        const double * row = A + r * row_stride;
+        double sum = 0.0;
+        #pragma omp simd reduction(+:sum)
+        for(size_t c = 0; c < num_cols; c++)
+        {
+            sum += row[c] * x[c];
+        }
+        y[r] = (beta == 0.0) ? alpha * sum : beta * y[r] + alpha * sum;
+    }
+}
+
+#if GEMV_X86
+
+// Sum of the 4 lanes of an AVX register
+__attribute__((target("avx2,fma")))
+inline double horizontal_sum_avx2(__m256d v)
+{
+    __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+
+// R rows with two accumulators per row, 2*R + 2 of the 16 AVX registers
+template<int R>
+__attribute__((target("avx2,fma")))
+inline void gemv_block_avx2(double alpha, const double * A, const double * x, double beta, double * y, size_t num_cols, size_t row_stride)
+{
+    __m256d acc0[R], acc1[R];
+    for(int r = 0; r < R; r++)
+    {
+        acc0[r] = acc1[r] = _mm256_setzero_pd();
+    }
+
+    size_t c = 0;
+    for(; c + 8 <= num_cols; c += 8)
+    {
+        __m256d x0 = _mm256_loadu_pd(x + c);
+        __m256d x1 = _mm256_loadu_pd(x + c + 4);
+        for(int r = 0; r < R; r++)
+        {
+            const double * row = A + r * row_stride + c;
+            _mm_prefetch((const char *)(row + GEMV_PREFETCH_DISTANCE), _MM_HINT_T0);
+            acc0[r] = _mm256_fmadd_pd(_mm256_loadu_pd(row), x0, acc0[r]);
+            acc1[r] = _mm256_fmadd_pd(_mm256_loadu_pd(row + 4), x1, acc1[r]);
+        }
+    }
+
+    for(int r = 0; r < R; r++)
+    {
+        const double * row = A + r * row_stride;
+        double sum = horizontal_sum_avx2(_mm256_add_pd(acc0[r], acc1[r]));
+        for(size_t k = c; k < num_cols; k++)
+        {
+            sum += row[k] * x[k];
+        }
+        y[r] = (beta == 0.0) ? alpha * sum : beta * y[r] + alpha * sum;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+inline void gemv_avx2(double alpha, const double * A, const double * x, double beta, double * y, size_t num_rows, size_t num_cols, size_t row_stride)
+{
+    size_t r = 0;
+    for(; r + 4 <= num_rows; r += 4)
+    {
+        gemv_block_avx2<4>(alpha, A + r * row_stride, x, beta, y + r, num_cols, row_stride);
+    }
+    for(; r < num_rows; r++)
+    {
+        gemv_block_avx2<1>(alpha, A + r * row_stride, x, beta, y + r, num_cols, row_stride);
+    }
+}
+
+// R rows with two accumulators per row, 2*R + 2 of the 32 AVX-512 registers. The last columns are
+// read with masked loads instead of a scalar loop.
+template<int R>
+__attribute__((target("avx512f")))
+inline void gemv_block_avx512(double alpha, const double * A, const double * x, double beta, double * y, size_t num_cols, size_t row_stride)
+{
+    __m512d acc0[R], acc1[R];
+    for(int r = 0; r < R; r++)
+    {
+        acc0[r] = acc1[r] = _mm512_setzero_pd();
+    }
+
+    size_t c = 0;
+    for(; c + 16 <= num_cols; c += 16)
+    {
+        __m512d x0 = _mm512_loadu_pd(x + c);
+        __m512d x1 = _mm512_loadu_pd(x + c + 8);
+        for(int r = 0; r < R; r++)
+        {
+            const double * row = A + r * row_stride + c;
+            _mm_prefetch((const char *)(row + GEMV_PREFETCH_DISTANCE), _MM_HINT_T0);
+            _mm_prefetch((const char *)(row + GEMV_PREFETCH_DISTANCE + 8), _MM_HINT_T0);
+            acc0[r] = _mm512_fmadd_pd(_mm512_loadu_pd(row), x0, acc0[r]);
+            acc1[r] = _mm512_fmadd_pd(_mm512_loadu_pd(row + 8), x1, acc1[r]);
+        }
+    }
+    for(; c < num_cols; c += 8)
+    {
+        __mmask8 mask = (num_cols - c >= 8) ? 0xff : (__mmask8)((1u << (num_cols - c)) - 1);
+        __m512d x0 = _mm512_maskz_loadu_pd(mask, x + c);
+        for(int r = 0; r < R; r++)
+        {
+            acc0[r] = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, A + r * row_stride + c), x0, acc0[r]);
+        }
+    }
+
+    for(int r = 0; r < R; r++)
+    {
+        alignas(64) double lanes[8];
+        _mm512_store_pd(lanes, _mm512_add_pd(acc0[r], acc1[r]));
+        double sum = ((lanes[0] + lanes[4]) + (lanes[2] + lanes[6])) + ((lanes[1] + lanes[5]) + (lanes[3] + lanes[7]));
+        y[r] = (beta == 0.0) ? alpha * sum : beta * y[r] + alpha * sum;
+    }
+}
+
+__attribute__((target("avx512f")))
+inline void gemv_avx512(double alpha, const double * A, const double * x, double beta, double * y, size_t num_rows, size_t num_cols, size_t row_stride)
+{
+    size_t r = 0;
+    for(; r + 8 <= num_rows; r += 8)
+    {
+        gemv_block_avx512<8>(alpha, A + r * row_stride, x, beta, y + r, num_cols, row_stride);
+    }
+    for(; r < num_rows; r++)
+    {
+        gemv_block_avx512<1>(alpha, A + r * row_stride, x, beta, y + r, num_cols, row_stride);
+    }
+}
+
+#endif
+
+// Best instruction set supported by the processor
+inline gemv_isa detect_gemv_isa()
+{
+#if GEMV_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        return GEMV_AVX512;
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return GEMV_AVX2;
+#endif
+    return GEMV_PORTABLE;
+}
+
+// True if the processor can run the kernel of the instruction set
+inline bool gemv_isa_supported(gemv_isa isa)
+{
+    return isa <= detect_gemv_isa();
+}
+
+inline const char * gemv_isa_name(gemv_isa isa)
+{
+    if(isa == GEMV_AVX512) return "avx512";
+    if(isa == GEMV_AVX2) return "avx2";
+    return "portable";
+}
+
+// Instruction set named `name` (portable, avx2 or avx512), returns false for an unknown name
+inline bool parse_gemv_isa(const char * name, gemv_isa * isa)
+{
+    if(strcmp(name, "portable") == 0) *isa = GEMV_PORTABLE;
+    else if(strcmp(name, "avx2") == 0) *isa = GEMV_AVX2;
+    else if(strcmp(name, "avx512") == 0) *isa = GEMV_AVX512;
+    else return false;
+    return true;
+}
+
+inline gemv_kernel select_gemv_kernel(gemv_isa isa)
+{
+#if GEMV_X86
+    if(isa == GEMV_AVX512) return gemv_avx512;
+    if(isa == GEMV_AVX2) return gemv_avx2;
+#endif
+    return gemv_portable;
+}
+
+// Rows [begin, end) of the calling thread in the partition of `num_rows` rows of schedule(static), so a
+// kernel called on them touches the same rows as the loops of the other routines over the local rows
+inline void static_thread_rows(size_t num_rows, int thread, int num_threads, size_t * begin, size_t * end)
+{
+    size_t chunk = num_rows / num_threads;
+    size_t extra = num_rows % num_threads;
+    *begin = thread * chunk + ((size_t)thread < extra ? thread : extra);
+    *end = *begin + chunk + ((size_t)thread < extra ? 1 : 0);
+}
+
+#endif
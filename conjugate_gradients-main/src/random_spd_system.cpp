@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
@@ -102,6 +103,127 @@ void random_spd_matrix(double * A, size_t size, int seed)
 
 
 
+void random_sparse_spd_matrix(size_t size, size_t nonzeros_per_row, int seed, size_t ** row_starts_out, size_t ** columns_out, double ** values_out)
+{
+    // random symmetric off-diagonal entries coupling every row to rows within a band of 1% of the size,
+    // like the neighbours of a discretization, then a dominant diagonal makes the matrix SPD
+    size_t pairs_per_row = nonzeros_per_row / 2;
+    size_t band = std::max(nonzeros_per_row, size / 100);
+    size_t num_pairs = size * pairs_per_row;
+    size_t * pair_rows = new size_t[num_pairs];
+    size_t * pair_cols = new size_t[num_pairs];
+    double * pair_values = new double[num_pairs];
+    size_t * row_starts = new size_t[size + 1];
+
+    srand(seed);
+    for(size_t r = 0; r <= size; r++)
+    {
+        row_starts[r] = 0;
+    }
+    size_t num_valid = 0;
+    for(size_t r = 0; r < size; r++)
+    {
+        for(size_t k = 0; k < pairs_per_row; k++)
+        {
+            size_t c = r + 1 + rand() % band;
+            double val = ((2.0 * rand()) / RAND_MAX) - 1.0;
+            if(c >= size)
+                continue;
+            pair_rows[num_valid] = r;
+            pair_cols[num_valid] = c;
+            pair_values[num_valid] = val;
+            num_valid++;
+            row_starts[r + 1]++;
+            row_starts[c + 1]++;
+        }
+        row_starts[r + 1]++; // diagonal
+    }
+    for(size_t r = 0; r < size; r++)
+    {
+        row_starts[r + 1] += row_starts[r];
+    }
+
+    // scatter both triangles and the diagonal into the rows
+    size_t nnz = row_starts[size];
+    size_t * columns = new size_t[nnz];
+    double * values = new double[nnz];
+    size_t * fill = new size_t[size];
+    for(size_t r = 0; r < size; r++)
+    {
+        fill[r] = row_starts[r];
+        columns[fill[r]] = r;
+        values[fill[r]] = 0.0;
+        fill[r]++;
+    }
+    for(size_t k = 0; k < num_valid; k++)
+    {
+        size_t r = pair_rows[k], c = pair_cols[k];
+        columns[fill[r]] = c;
+        values[fill[r]++] = pair_values[k];
+        columns[fill[c]] = r;
+        values[fill[c]++] = pair_values[k];
+    }
+
+    // sort the rows by column, merge duplicates and set the diagonal to 1 + the sum of the off-diagonal magnitudes
+    size_t * order = new size_t[size + 1];
+    size_t out = 0;
+    size_t row_begin = 0;
+    for(size_t r = 0; r < size; r++)
+    {
+        size_t row_end = row_starts[r + 1];
+        size_t length = row_end - row_begin;
+        std::vector<std::pair<size_t, double>> row(length);
+        for(size_t k = 0; k < length; k++)
+        {
+            row[k] = std::make_pair(columns[row_begin + k], values[row_begin + k]);
+        }
+        std::sort(row.begin(), row.end(), [](const std::pair<size_t, double> & a, const std::pair<size_t, double> & b) { return a.first < b.first; });
+
+        size_t row_out = out;
+        size_t diag = out;
+        double off_sum = 0.0;
+        for(size_t k = 0; k < length; k++)
+        {
+            if(out > row_out && columns[out - 1] == row[k].first)
+            {
+                values[out - 1] += row[k].second;
+                continue;
+            }
+            columns[out] = row[k].first;
+            values[out] = row[k].second;
+            out++;
+        }
+        for(size_t k = row_out; k < out; k++)
+        {
+            if(columns[k] == r)
+                diag = k;
+            else
+                off_sum += std::abs(values[k]);
+        }
+        values[diag] = 1.0 + off_sum;
+
+        order[r] = row_out;
+        row_begin = row_end;
+    }
+    order[size] = out;
+    for(size_t r = 0; r <= size; r++)
+    {
+        row_starts[r] = order[r];
+    }
+
+    delete[] pair_rows;
+    delete[] pair_cols;
+    delete[] pair_values;
+    delete[] fill;
+    delete[] order;
+
+    *row_starts_out = row_starts;
+    *columns_out = columns;
+    *values_out = values;
+}
+
+
+
 bool write_matrix_to_file(const char * filename, const double * matrix, size_t num_rows, size_t num_cols)
 {
     FILE * file = fopen(filename, "wb");
@@ -123,10 +245,37 @@ bool write_matrix_to_file(const char * filename, const double * matrix, size_t n
 
 
 
+bool write_csr_matrix_to_file(const char * filename, const size_t * row_starts, const size_t * columns, const double * values, size_t num_rows, size_t num_cols)
+{
+    FILE * file = fopen(filename, "wb");
+    if(file == nullptr)
+    {
+        fprintf(stderr, "Cannot open output file\n");
+        return false;
+    }
+
+    // header with the sizes and the number of nonzeros, then the row starts, the column indices and the values
+    size_t nnz = row_starts[num_rows];
+    fwrite(&num_rows, sizeof(size_t), 1, file);
+    fwrite(&num_cols, sizeof(size_t), 1, file);
+    fwrite(&nnz, sizeof(size_t), 1, file);
+    fwrite(row_starts, sizeof(size_t), num_rows + 1, file);
+    fwrite(columns, sizeof(size_t), nnz, file);
+    fwrite(values, sizeof(double), nnz, file);
+
+    fclose(file);
+
+    return true;
+}
+
+
+
+
 
 int main(int argc, char ** argv)
 {
-    printf("Usage: ./random_spd_system matrix_size output_file_matrix.bin output_file_rhs.bin random_seed\n");
+    printf("Usage: ./random_spd_system matrix_size output_file_matrix.bin output_file_rhs.bin random_seed nonzeros_per_row\n");
+    printf("A positive nonzeros_per_row writes a sparse matrix in CSR format instead of a dense one\n");
     printf("All parameters are optional and have default values\n");
     printf("\n");
 
@@ -134,20 +283,23 @@ int main(int argc, char ** argv)
     const char * output_file_rhs = "io/rhs.bin";
     size_t size = 10;
     int seed = time(nullptr);
+    size_t nonzeros_per_row = 0;
 
     if(argc > 1) size = static_cast<size_t>(atoll(argv[1]));
     if(argc > 2) output_file_matrix = argv[2];
     if(argc > 3) output_file_rhs = argv[3];
     if(argc > 4) seed = atoi(argv[4]);
+    if(argc > 5) nonzeros_per_row = static_cast<size_t>(atoll(argv[5]));
 
     printf("Command line arguments:\n");
     printf("  matrix_size:        %zu\n", size);
     printf("  output_file_matrix: %s\n", output_file_matrix);
     printf("  output_file_rhs:    %s\n", output_file_rhs);
     printf("  seed:               %d\n", seed);
+    printf("  nonzeros_per_row:   %zu\n", nonzeros_per_row);
     printf("\n");
 
-    if((ssize_t)size <= 0)
+    if((ssize_t)size <= 0 || (ssize_t)nonzeros_per_row < 0)
     {
         fprintf(stderr, "Wrong argument value\n");
         return 1;
@@ -156,8 +308,19 @@ int main(int argc, char ** argv)
 
 
     printf("Generating the matrix ...\n");
-    double * matrix = new double[size * size];
-    random_spd_matrix(matrix, size, seed);
+    double * matrix = nullptr;
+    size_t * row_starts = nullptr;
+    size_t * columns = nullptr;
+    double * values = nullptr;
+    if(nonzeros_per_row > 0)
+    {
+        random_sparse_spd_matrix(size, nonzeros_per_row, seed, &row_starts, &columns, &values);
+    }
+    else
+    {
+        matrix = new double[size * size];
+        random_spd_matrix(matrix, size, seed);
+    }
     printf("Done\n");
     printf("\n");
 
@@ -168,7 +331,11 @@ int main(int argc, char ** argv)
     printf("\n");
 
     printf("Writing matrix to file ...\n");
-    bool success_write_matrix = write_matrix_to_file(output_file_matrix, matrix, size, size);
+    bool success_write_matrix;
+    if(nonzeros_per_row > 0)
+        success_write_matrix = write_csr_matrix_to_file(output_file_matrix, row_starts, columns, values, size, size);
+    else
+        success_write_matrix = write_matrix_to_file(output_file_matrix, matrix, size, size);
     if(!success_write_matrix)
     {
         fprintf(stderr, "Failed to save matrix\n");
@@ -188,6 +355,9 @@ int main(int argc, char ** argv)
     printf("\n");
 
     delete[] matrix;
+    delete[] row_starts;
+    delete[] columns;
+    delete[] values;
     delete[] rhs;
 
     printf("Finished successfully\n");